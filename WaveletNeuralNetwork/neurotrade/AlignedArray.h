@@ -0,0 +1,75 @@
+/*
+ * AlignedArray.h
+ *  A float array on a cache line boundary, for the vector kernels.
+ *  Created on: 5 Mar 2014
+ *      Author: jeevw
+ */
+
+#ifndef _NEUROTRADE_ALIGNEDARRAY_H_
+#define _NEUROTRADE_ALIGNEDARRAY_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+
+class AlignedArray
+{
+  public:
+
+	static const unsigned int Alignment = 64;
+
+	// Rounds a row length up to whole cache lines.
+	static unsigned int stride( unsigned int n )
+		{ return ( n + Alignment / sizeof(float) - 1 ) / ( Alignment / sizeof(float) ) * ( Alignment / sizeof(float) ); }
+
+	AlignedArray() : _data(NULL), _size(0) {}
+	explicit AlignedArray( unsigned long n ) : _data(NULL), _size(0) { resize( n ); }
+	AlignedArray( const AlignedArray &a ) : _data(NULL), _size(0) { *this = a; }
+	~AlignedArray() { free( _data ); }
+
+	AlignedArray &operator=( const AlignedArray &a )
+		{
+			if ( this != &a )
+			{
+				resize( a._size );
+				if ( _size > 0 ) memcpy( _data, a._data, _size * sizeof(float) );
+			}
+			return *this;
+		}
+
+	// Zero filled; the old contents are not kept.
+	void resize( unsigned long n )
+		{
+			void *p = NULL;
+
+			free( _data );
+			_data = NULL;
+			_size = 0;
+			if ( n == 0 ) return;
+
+			if ( posix_memalign( &p, Alignment, n * sizeof(float) ) != 0 )
+			{
+				throw std::bad_alloc();
+			}
+			_data = (float *)p;
+			_size = n;
+			memset( _data, 0, n * sizeof(float) );
+		}
+
+	float &operator[]( unsigned long i )		{ return _data[i]; }
+	float operator[]( unsigned long i ) const	{ return _data[i]; }
+
+	float *data()				{ return _data; }
+	const float *data() const	{ return _data; }
+	unsigned long size() const	{ return _size; }
+
+
+  private:
+
+	float			*_data;
+	unsigned long	_size;
+
+};
+
+#endif /* _NEUROTRADE_ALIGNEDARRAY_H_ */
@@ -0,0 +1,501 @@
+/*
+ * BarLoader.cpp
+ *
+ *  Created on: 24 Feb 2014
+ *      Author: jeevw
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <string.h>
+#include <algorithm>
+#include <queue>
+#include <functional>
+
+#include "BarLoader.h"
+#include "ThreadPool.h"
+
+
+static const double Pow10[] =
+{
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+static inline void skipBlanks( const char *&p, const char *end )
+{
+	while ( p < end  &&  ( *p == ' ' || *p == '\t' || *p == '"' ) ) ++p;
+}
+
+static inline bool parseUInt( const char *&p, const char *end, unsigned int &v )
+{
+	const char *s;
+	unsigned int x = 0;
+
+	skipBlanks( p, end );
+	s = p;
+	while ( p < end  &&  *p >= '0'  &&  *p <= '9' )
+	{
+		x = x * 10 + ( *p++ - '0' );
+	}
+	v = x;
+	return p != s;
+}
+
+/* Decimal numbers as they come in the bar files: [-]digits[.digits][e[-]digits].
+ * The digits are gathered in an integer and scaled once by an exact power of ten.
+ */
+static inline bool parseFloat( const char *&p, const char *end, float &v )
+{
+	unsigned long long m = 0;
+	unsigned int e;
+	int scale = 0, digits = 0;
+	bool neg = false, negExp;
+	double d;
+
+	skipBlanks( p, end );
+	if ( p < end  &&  ( *p == '-' || *p == '+' ) )
+	{
+		neg = ( *p++ == '-' );
+	}
+
+	for ( ; p < end  &&  *p >= '0'  &&  *p <= '9'; ++p, ++digits )
+	{
+		if ( m < 100000000000000000ULL )	m = m * 10 + ( *p - '0' );
+		else								++scale;
+	}
+	if ( p < end  &&  *p == '.' )
+	{
+		for ( ++p; p < end  &&  *p >= '0'  &&  *p <= '9'; ++p, ++digits )
+		{
+			if ( m < 100000000000000000ULL )
+			{
+				m = m * 10 + ( *p - '0' );
+				--scale;
+			}
+		}
+	}
+	if ( digits == 0 )
+	{
+		return false;
+	}
+
+	if ( p < end  &&  ( *p == 'e' || *p == 'E' ) )
+	{
+		++p;
+		negExp = ( p < end  &&  *p == '-' );
+		if ( p < end  &&  ( *p == '-' || *p == '+' ) ) ++p;
+		if ( !parseUInt( p, end, e ) )
+		{
+			return false;
+		}
+		scale += negExp ? -(int)e : (int)e;
+	}
+
+	d = (double)m;
+	while ( scale < -22 )	{ d /= 1e22;  scale += 22; }
+	while ( scale > 22 )	{ d *= 1e22;  scale -= 22; }
+	d = ( scale < 0 ) ? d / Pow10[-scale] : d * Pow10[scale];
+
+	v = neg ? -d : d;
+	return true;
+}
+
+static inline bool expect( const char *&p, const char *end, char c )
+{
+	skipBlanks( p, end );
+	if ( p < end  &&  *p == c )
+	{
+		++p;
+		return true;
+	}
+	return false;
+}
+
+// m/d/Y, as str_to_date( @col1, '%m/%d/%Y')
+static inline bool parseDate( const char *&p, const char *end, unsigned int &date )
+{
+	unsigned int m, d, y;
+
+	if ( !parseUInt( p, end, m ) || !expect( p, end, '/' ) ||
+		 !parseUInt( p, end, d ) || !expect( p, end, '/' ) ||
+		 !parseUInt( p, end, y ) )
+	{
+		return false;
+	}
+	if ( y < 100 ) y += 2000;
+	if ( m < 1 || m > 12 || d < 1 || d > 31 )
+	{
+		return false;
+	}
+
+	date = y * 10000 + m * 100 + d;
+	return true;
+}
+
+// h:mm[:ss] or hhmm
+static inline bool parseTime( const char *&p, const char *end, unsigned int &time )
+{
+	unsigned int h, m = 0, s = 0;
+
+	if ( !parseUInt( p, end, h ) )
+	{
+		return false;
+	}
+	if ( p < end  &&  *p == ':' )
+	{
+		++p;
+		if ( !parseUInt( p, end, m ) ) return false;
+		if ( p < end  &&  *p == ':' )
+		{
+			++p;
+			if ( !parseUInt( p, end, s ) ) return false;
+		}
+	}
+	else
+	{
+		m = h % 100;
+		h = h / 100;
+	}
+	if ( h > 23 || m > 59 || s > 59 )
+	{
+		return false;
+	}
+
+	time = h * 10000 + m * 100 + s;
+	return true;
+}
+
+static inline const char *nextLine( const char *p, const char *end )
+{
+	const char *nl = (const char *)memchr( p, '\n', end - p );
+	return nl ? nl + 1 : end;
+}
+
+
+long BarLoader::parse( const char *p, const char *end, vector<Bar> &bars, unsigned long &badLines )
+{
+	const char *eol;
+	unsigned long n = 0;
+	Bar b;
+
+	while ( p < end )
+	{
+		eol = nextLine( p, end );
+
+		if ( parseDate( p, eol, b.date )	&& expect( p, eol, ',' ) &&
+			 parseTime( p, eol, b.time )	&& expect( p, eol, ',' ) &&
+			 parseFloat( p, eol, b.open )	&& expect( p, eol, ',' ) &&
+			 parseFloat( p, eol, b.high )	&& expect( p, eol, ',' ) &&
+			 parseFloat( p, eol, b.low )	&& expect( p, eol, ',' ) &&
+			 parseFloat( p, eol, b.close )	&& expect( p, eol, ',' ) &&
+			 parseUInt( p, eol, b.upticks )	&& expect( p, eol, ',' ) &&
+			 parseUInt( p, eol, b.downticks ) )
+		{
+			bars.push_back( b );
+			++n;
+		}
+		else
+		{
+			// blank lines are not worth a mention
+			for ( ; p < eol  &&  ( *p == ' ' || *p == '\t' || *p == '\r' || *p == '\n' ); ++p );
+			if ( p != eol ) ++badLines;
+		}
+		p = eol;
+	}
+
+	return n;
+}
+
+
+long BarLoader::parseFile( const string &path, vector<Bar> &bars )
+{
+	struct stat st;
+	const char *data, *p, *end;
+	unsigned long badLines = 0;
+	long n;
+	int fd;
+
+	fd = open( path.c_str(), O_RDONLY );
+	if ( fd < 0 )
+	{
+		Util::log( ERROR, "[BarLoader::parseFile()] Cannot open bar data file: " + path );
+		return -1;
+	}
+	if ( fstat( fd, &st ) != 0 )
+	{
+		Util::log( ERROR, "[BarLoader::parseFile()] Cannot stat bar data file: " + path );
+		close( fd );
+		return -1;
+	}
+	if ( st.st_size == 0 )
+	{
+		close( fd );
+		return 0;
+	}
+
+	data = (const char *)mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if ( data == MAP_FAILED )
+	{
+		Util::log( ERROR, "[BarLoader::parseFile()] Cannot map bar data file: " + path );
+		return -1;
+	}
+	madvise( (void *)data, st.st_size, MADV_SEQUENTIAL );
+
+	end = data + st.st_size;
+	bars.reserve( bars.size() + st.st_size / 40 );	// a bar line is a little over 40 bytes
+
+	p = nextLine( data, end );	// IGNORE 1 LINES
+	n = parse( p, end, bars, badLines );
+
+	munmap( (void *)data, st.st_size );
+
+	if ( badLines > 0 )
+	{
+		Util::log( ERROR, string("[BarLoader::parseFile()] Skipped ") + Util::itoa( badLines )
+						  + " lines that are not bars in: " + path );
+	}
+
+	return n;
+}
+
+
+bool BarLoader::listDir( const string &dir, vector<string> &files )
+{
+	DIR *pdir;
+	struct dirent *entry;
+
+	pdir = opendir( dir.c_str() );
+	if ( !pdir )
+	{
+		Util::log( CRITICAL, "[BarLoader::listDir()] Cannot access NeuroTrade data directory: " + dir );
+		return false;
+	}
+
+	while ( (entry = readdir(pdir)) )
+	{
+		if ( entry->d_name[0] != '.' )
+		{
+			files.push_back( entry->d_name );
+		}
+	}
+	closedir( pdir );
+
+	sort( files.begin(), files.end() );
+	return true;
+}
+
+
+namespace
+{
+	class ParseTask: public ThreadTask
+	{
+	  public:
+		ParseTask( const string &path, vector<Bar> &bars )
+			: _path(path), _bars(bars), _n(0)
+		{}
+		void run() { _n = BarLoader::parseFile( _path, _bars ); }
+		long getNumBars() const { return _n; }
+	  private:
+		string		_path;
+		vector<Bar>	&_bars;
+		long		_n;
+	};
+}
+
+
+long BarLoader::loadDir( const string &dir )
+{
+	vector<string> files;
+	vector< vector<Bar> > fileBars;
+	vector<ParseTask> parsers;
+	vector<ThreadTask *> tasks;
+	double t0 = Util::getTime(), secs;
+
+	if ( !listDir( dir, files ) )
+	{
+		return -1;
+	}
+
+	fileBars.resize( files.size() );
+	parsers.reserve( files.size() );
+	for ( unsigned int i = 0; i < files.size(); ++i )
+	{
+		parsers.push_back( ParseTask( dir + "/" + files[i], fileBars[i] ) );
+	}
+	for ( unsigned int i = 0; i < files.size(); ++i )
+	{
+		tasks.push_back( &parsers[i] );
+	}
+	ThreadPool::getDefault().run( tasks );
+
+	for ( unsigned int i = 0; i < files.size(); ++i )
+	{
+		if ( parsers[i].getNumBars() < 0 )
+		{
+			Util::log( ERROR, string("[BarLoader::loadDir()] Failed to load NeuroTrade data in: ") + files[i] );
+			continue;
+		}
+		Util::log( SUCCESS, string("[BarLoader::loadDir()] Loaded ") + Util::itoa( parsers[i].getNumBars() )
+							+ " bars in: " + files[i] );
+	}
+
+	merge( fileBars );
+
+	secs = Util::getTime() - t0;
+	Util::log( INFO, string("[BarLoader::loadDir()] Loaded ") + Util::itoa( _bars.size() ) + " bars from "
+					 + Util::itoa( files.size() ) + " files in " + Util::ftoa( secs ) + "s." );
+
+	return _bars.size();
+}
+
+
+void BarLoader::merge( vector< vector<Bar> > &fileBars )
+{
+	typedef pair<unsigned long long, unsigned int> Head;	// next timestamp of a file
+	priority_queue< Head, vector<Head>, greater<Head> > heads;
+	vector<unsigned long> pos( fileBars.size(), 0 );
+	vector<bool> retired( fileBars.size(), false );
+	vector<unsigned int> lead( fileBars.size(), 0 );	// bars in a row a file out-traded the one in use
+	vector< pair<unsigned int, const Bar *> > group;	// the files with a bar at the next time
+	unsigned long total = 0, duplicates = 0, rolls = 0;
+	unsigned long long ts;
+	int current = -1, chosen;
+	unsigned int f, ticks, best, currentTicks;
+	const Bar *bar = NULL, *currentBar;
+
+	for ( f = 0; f < fileBars.size(); ++f )
+	{
+		// a file is mostly in order already
+		stable_sort( fileBars[f].begin(), fileBars[f].end() );
+		for ( unsigned long i = 0; i < fileBars[f].size(); ++i )
+		{
+			fileBars[f][i].source = f;
+		}
+		if ( !fileBars[f].empty() )
+		{
+			heads.push( Head( fileBars[f][0].getTimestamp(), f ) );
+		}
+		total += fileBars[f].size();
+	}
+
+	_bars.clear();
+	_bars.reserve( total );
+
+	while ( !heads.empty() )
+	{
+		ts = heads.top().first;
+		group.clear();
+		while ( !heads.empty()  &&  heads.top().first == ts )
+		{
+			f = heads.top().second;
+			heads.pop();
+			group.push_back( make_pair( f, &fileBars[f][pos[f]] ) );
+
+			// the same time twice in one file: the first one stands
+			for ( ++pos[f]; pos[f] < fileBars[f].size()  &&  fileBars[f][pos[f]].getTimestamp() == ts; ++pos[f] )
+			{
+				++duplicates;
+			}
+			if ( pos[f] < fileBars[f].size() )
+			{
+				heads.push( Head( fileBars[f][pos[f]].getTimestamp(), f ) );
+			}
+		}
+
+		currentBar = NULL;
+		currentTicks = 0;
+		for ( unsigned int g = 0; g < group.size(); ++g )
+		{
+			if ( (int)group[g].first == current )
+			{
+				currentBar = group[g].second;
+				currentTicks = currentBar->upticks + currentBar->downticks;
+			}
+		}
+
+		// the busiest other contract, and how long each has out-traded the one in use
+		chosen = -1;
+		best = 0;
+		for ( unsigned int g = 0; g < group.size(); ++g )
+		{
+			f = group[g].first;
+			if ( retired[f]  ||  (int)f == current ) continue;
+
+			ticks = group[g].second->upticks + group[g].second->downticks;
+			if ( currentBar )
+			{
+				lead[f] = ( ticks > currentTicks ) ? lead[f] + 1 : 0;
+			}
+			if ( chosen < 0  ||  ticks > best )
+			{
+				chosen = f;
+				best = ticks;
+				bar = group[g].second;
+			}
+		}
+		duplicates += group.size() - ( ( currentBar || chosen >= 0 ) ? 1 : 0 );
+
+		if ( currentBar  &&  ( chosen < 0  ||  lead[chosen] < Param::Roll_Confirm_Bars ) )
+		{
+			bar = currentBar;	// a bar the back month trades more in is not yet a roll
+		}
+		else if ( chosen < 0 )
+		{
+			continue;	// only contracts we have rolled out of
+		}
+		else if ( current < 0 )
+		{
+			current = chosen;	// the first contract
+		}
+		else if ( currentBar  ||  pos[current] >= fileBars[current].size() )
+		{
+			// out-traded for long enough, or expired: roll for good
+			retired[current] = true;
+			++rolls;
+			current = chosen;
+			fill( lead.begin(), lead.end(), 0 );
+		}
+		// else a gap in the contract in use: the bar is taken from another, without rolling
+		_bars.push_back( *bar );
+	}
+
+	if ( duplicates > 0  ||  rolls > 0 )
+	{
+		Util::log( INFO, string("[BarLoader::merge()] Dropped ") + Util::itoa( duplicates )
+						 + " overlapping bars; rolled " + Util::itoa( rolls ) + " times." );
+	}
+}
+
+
+void BarLoader::calcReturns( SampleStore &store ) const
+{
+	float *r;
+
+	store.clear();
+	if ( _bars.size() < 2 )
+	{
+		return;
+	}
+
+	r = store.extend( _bars.size() - 1 );
+	for ( unsigned long i = 1; i < _bars.size(); ++i )
+	{
+		if ( _bars[i].source == _bars[i-1].source )
+		{
+			r[i-1] = _bars[i].close - _bars[i-1].close;
+		}
+		else	// rolled
+		{
+			r[i-1] = _bars[i].close - _bars[i].open;
+		}
+	}
+
+	Util::log( DEBUG, string("[BarLoader::calcReturns()] Calculated ") + Util::itoa( _bars.size() - 1 )
+					  + " returns; " + Util::itoa( store.getNumWindows() ) + " samples." );
+}
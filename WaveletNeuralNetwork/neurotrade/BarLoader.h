@@ -0,0 +1,86 @@
+/*
+ * BarLoader.h
+ *  Loads the bar data files straight into memory, without the database.
+ *  Created on: 24 Feb 2014
+ *      Author: jeevw
+ */
+
+#ifndef _NEUROTRADE_BARLOADER_H_
+#define _NEUROTRADE_BARLOADER_H_
+
+#include <string>
+#include <vector>
+
+#include "def.h"
+#include "SampleStore.h"
+
+
+using namespace std;
+
+
+struct Bar
+{
+	unsigned int	date;		// yyyymmdd
+	unsigned int	time;		// hhmmss
+	float			open;
+	float			high;
+	float			low;
+	float			close;
+	unsigned int	upticks;
+	unsigned int	downticks;
+	unsigned short	source;		// the data file it came from, in load order
+
+	// yyyymmddhhmmss; orders bars in time
+	unsigned long long getTimestamp() const
+		{ return (unsigned long long)date * 1000000 + time; }
+
+	bool operator<( const Bar &b ) const { return getTimestamp() < b.getTimestamp(); }
+};
+
+
+class BarLoader
+{
+  public:
+
+	/* Parses one bar data file in the layout LOAD DATA took:
+	 * a header line, then  date (m/d/Y), time, open, high, low, close, upticks, downticks
+	 * Lines that do not parse are skipped and counted.
+	 * Appends to bars; returns the number of bars read or -1 if the file cannot be read.
+	 */
+	static long parseFile( const string &path, vector<Bar> &bars );
+	static long parse( const char *p, const char *end, vector<Bar> &bars, unsigned long &badLines );
+
+	// The data files in a directory, by name.
+	static bool listDir( const string &dir, vector<string> &files );
+
+	/* Loads every file in the directory, parsing the files concurrently on the
+	 * default thread pool, and merges them. Returns the number of bars or -1.
+	 */
+	long loadDir( const string &dir = Param::DBDataDir );
+
+	/* Merges the bars of each data file into one time-ordered series.
+	 * Where files overlap, e.g. two contracts around a roll, a time is taken from
+	 * one file only: the one in use, or if it has no bar then, the busiest other.
+	 * The series rolls to another contract for good once that has traded more
+	 * ticks than the one in use in Param::Roll_Confirm_Bars of their bars in a
+	 * row, or once the one in use has no bars left.
+	 */
+	void merge( vector< vector<Bar> > &fileBars );
+
+	/* The close-to-close change of every bar after the first, as sp_calc_returns computed it.
+	 * At a roll, the closes of two contracts differ by the basis, so the
+	 * first bar of the new contract gets its own open-to-close change.
+	 */
+	void calcReturns( SampleStore &store ) const;
+
+	const vector<Bar> &getBars() const { return _bars; }
+	void clear() { _bars.clear(); }
+
+
+  private:
+
+	vector<Bar>	_bars;
+
+};
+
+#endif /* _NEUROTRADE_BARLOADER_H_ */
@@ -8,89 +8,209 @@
 
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <math.h>
+#include <algorithm>
+#include <float.h>
 
 #include "def.h"
 #include "KMeansClustering.h"
+#include "VectorKernels.h"
+#include "ThreadPool.h"
+#include "AlignedArray.h"
 
 
 
 KMeansClustering KMeansClustering::kMeansClusters;
 
 
-void Mean::addSample( vector<float> m )
+void ClusterStatistics::clear()
 {
+	_count = 0;
+	fill( _mean.begin(), _mean.end(), 0.0 );
+	fill( _m2.begin(), _m2.end(), 0.0 );
+	fill( _meanf.begin(), _meanf.end(), 0.0f );
+}
+
+
+void ClusterStatistics::addSample( const SampleView &m )
+{
+	double x, d, inv;
+
 	if ( m.size() < _mean.size() )
 	{
-		throw invalid_argument("Mean::addMean() mean has fewer that required features.");
+		throw invalid_argument("ClusterStatistics::addSample() sample has fewer that required features.");
 	}
 
 	_count++;
+	inv = 1.0 / _count;
 	for ( unsigned int i=0; i< _mean.size(); ++i )
 	{
-		_mean_acc[i] += m[i];
-		_mean[i] = _mean_acc[i] / _count;
+		x = m[i];
+		d = x - _mean[i];
+		_mean[i] += d * inv;
+		_m2[i] += d * ( x - _mean[i] );
+		_meanf[i] = _mean[i];
 	}
 }
 
 
-float Cluster::getSSE( vector<float> p1, vector<float> p2, unsigned int numItemsToCompare )
+void ClusterStatistics::removeSample( const SampleView &m )
 {
-	float rtn = 0;
+	double x, d, prev, inv;
 
-	if ( numItemsToCompare > p1.size()  || numItemsToCompare > p2.size() )
+	if ( m.size() < _mean.size() )
 	{
-		rtn = -1;
+		throw invalid_argument("ClusterStatistics::removeSample() sample has fewer that required features.");
 	}
-	else
+	if ( _count <= 1 )
 	{
-		for ( unsigned int i=0; i< numItemsToCompare; ++i )
-		{
-			rtn += ( p1[i] - p2[i] ) * ( p1[i] - p2[i] );
-		}
+		clear();
+		return;
 	}
-	return sqrt(rtn);
+
+	// Welford's step backwards: the mean without x, and x's share of the deviations
+	inv = 1.0 / ( _count - 1 );
+	for ( unsigned int i=0; i< _mean.size(); ++i )
+	{
+		x = m[i];
+		d = x - _mean[i];
+		prev = _mean[i] - d * inv;
+		_m2[i] -= d * ( x - prev );
+		if ( _m2[i] < 0 ) _m2[i] = 0;
+		_mean[i] = prev;
+		_meanf[i] = prev;
+	}
+	_count--;
 }
 
 
-void Cluster::setStatistics()
+void ClusterStatistics::add( const ClusterStatistics &s )
 {
-	vector<double> m( Param::InputSampleSize +1, 0.0 );
+	double n, f, delta;
 
-	_size = _cluster.size();
+	if ( s._count == 0 )
+	{
+		return;
+	}
+	if ( _count == 0 )
+	{
+		*this = s;
+		return;
+	}
+	if ( s._mean.size() != _mean.size() )
+	{
+		throw invalid_argument("ClusterStatistics::add() statistics of different sizes.");
+	}
 
-	if ( !_mean_set)
+	n = (double)_count + s._count;
+	f = (double)_count * s._count / n;
+	for ( unsigned int i=0; i< _mean.size(); ++i )
 	{
-		_mean = vector<float>( Param::InputSampleSize +1, 0.0 );
-		for ( unsigned int i=0; i < _size; ++i )
-		{
-			for ( unsigned int j=0; j < Param::InputSampleSize +1; ++j )
-			{
-				m[j] += _cluster[i][j];
-			}
-		}
+		delta = s._mean[i] - _mean[i];
+		_mean[i] += delta * s._count / n;
+		_m2[i] += s._m2[i] + delta * delta * f;
+		_meanf[i] = _mean[i];
+	}
+	_count += s._count;
+}
 
-		for ( unsigned int j=0; j < Param::InputSampleSize +1; ++j )
-		{
-			_mean[j] = m[j] / _size;
-		}
-		_mean_set = true;
-		_sse_set = false;
+
+double ClusterStatistics::getSSE() const
+{
+	double sse = 0;
+
+	for ( unsigned int i=0; i< _m2.size(); ++i )
+	{
+		sse += _m2[i];
+	}
+	return sse;
+}
+
+
+void ClusterStatistics::set( unsigned long count, const double *mean, const double *m2 )
+{
+	_count = count;
+	for ( unsigned int i=0; i< _mean.size(); ++i )
+	{
+		_mean[i] = mean[i];
+		_m2[i] = m2[i];
+		_meanf[i] = mean[i];
+	}
+}
+
+
+float Cluster::getSSE( const vector<float> &p1, const vector<float> &p2, unsigned int numItemsToCompare )
+{
+	if ( numItemsToCompare > p1.size()  || numItemsToCompare > p2.size() )
+	{
+		return sqrt(-1);
 	}
+	return getSSE( &p1[0], &p2[0], numItemsToCompare );
+}
 
-	if ( !_sse_set)
+float Cluster::getSSE( const SampleView &p1, const vector<float> &p2, unsigned int numItemsToCompare )
+{
+	if ( numItemsToCompare > p1.size()  || numItemsToCompare > p2.size() )
 	{
-		_sse = 0;
-		for ( unsigned int i=0; i < _size; ++i )
+		return sqrt(-1);
+	}
+	return getSSE( p1.data(), &p2[0], numItemsToCompare );
+}
+
+float Cluster::getSSE( const float *p1, const float *p2, unsigned int numItemsToCompare )
+{
+	return sqrt( VectorKernels::squaredDistance( p1, p2, numItemsToCompare ) );
+}
+
+
+namespace
+{
+	// Statistics of a range of samples, a chunk at a time, merged in chunk order.
+	class StatisticsTask: public RangeTask
+	{
+	  public:
+		StatisticsTask( const ClusterT &samples, unsigned long begin, unsigned int numChunks )
+			: _samples(samples), _begin(begin), _partials( numChunks )
+		{}
+		void run( unsigned long begin, unsigned long end, unsigned int chunk )
 		{
-			for ( unsigned int j=0; j < Param::InputSampleSize +1; ++j)
+			for ( unsigned long i = begin; i < end; ++i )
 			{
-				_sse += (_cluster[i][j] - m[j]) * (_cluster[i][j] - m[j]);
+				_partials[chunk].addSample( _samples[ _begin + i ] );
 			}
 		}
-		_sse = sqrt(_sse);
-		_sse_set = true;
+		void reduce( ClusterStatistics &stats ) const
+		{
+			for ( unsigned int c = 0; c < _partials.size(); ++c )
+			{
+				stats.add( _partials[c] );
+			}
+		}
+	  private:
+		const ClusterT				&_samples;
+		unsigned long				_begin;
+		vector<ClusterStatistics>	_partials;
+	};
+}
+
+
+Cluster::Cluster( const ClusterT &samples, unsigned long begin, unsigned long end )
+	: _samples(&samples), _begin(begin), _end(end)
+{
+	static const unsigned int NumChunks = 64;	// fixed, so the sums do not depend on the threads
+	unsigned int numChunks = min( (unsigned long)NumChunks, end - begin );
+
+	if ( numChunks > 0 )
+	{
+		StatisticsTask task( samples, begin, numChunks );
+
+		ThreadPool::getDefault().parallelFor( end - begin, task, numChunks );
+		task.reduce( _stats );
 	}
 }
 
@@ -98,51 +218,26 @@ void Cluster::setStatistics()
 void KMeansClustering::clear()
 {
 	_clusters.clear();
+	_treeNodes.clear();
+	_samples.clear();
 	_numClusters = 0;
 	_sse = 0.0;
 	_sse_set = true;
 	_numSamples = 0;
 }
 
-void KMeansClustering::initClustering( ClusterT &cl )
+void KMeansClustering::initClustering( const ClusterT &cl )
 {
-	Cluster cl1( cl );
 	_clusters.clear();
-	_clusters.push_back( cl1 );
+	_treeNodes.clear();
+	_samples.assign( cl.begin(), cl.end() );
+	_clusters.push_back( Cluster( _samples, 0, _samples.size() ) );
 	_numClusters = 1;
-	_sse = cl1.getSSE();
+	_sse = _clusters.front().getSSE();
 	_sse_set = true;
 	_numSamples = getNumSamples();
 }
 
-void KMeansClustering::addCluster( ClusterT &cl)
-{
-	Cluster c( cl );
-	_clusters.push_back( c );
-
-	++_numClusters;
-	if ( _sse_set )
-	{
-		_sse += c.getSSE();
-	}
-
-	_numSamples = getNumSamples();
-}
-
-void KMeansClustering::addCluster( ClusterT &cl, Mean &m )
-{
-	Cluster c( cl, m.getMean() );
-	_clusters.push_back( c );
-
-	++_numClusters;
-	if ( _sse_set )
-	{
-		_sse += c.getSSE();
-	}
-
-	_numSamples = getNumSamples();
-}
-
 unsigned int KMeansClustering::getNumSamples()
 {
 	list<Cluster>::iterator i;
@@ -172,17 +267,180 @@ double KMeansClustering::getSSE()
 
 
 
+// The seed of a trial's generator, mixed from the clustering's seed, the bisection and the trial.
+static unsigned int trialSeed( unsigned int seed, unsigned int bisection, unsigned int trial )
+{
+	unsigned int h = 2166136261u;
+
+	h = ( h ^ seed ) * 16777619u;
+	h = ( h ^ bisection ) * 16777619u;
+	h = ( h ^ trial ) * 16777619u;
+	return h;
+}
+
+
+// An index in [0, n), of two draws so that n can pass RAND_MAX.
+static inline unsigned long randomIndex( unsigned int &state, unsigned long n )
+{
+	unsigned long high = rand_r( &state );
+
+	return ( high * ( (unsigned long)RAND_MAX + 1 ) + rand_r( &state ) ) % n;
+}
+
+
+/* One trial bisection of a cluster, from two seed samples drawn at random.
+ * Draws again while either half is under the minimum size, easing the minimum
+ * by 1% every second try. Only marks the side of each sample; the cluster's
+ * samples are moved once, by the best trial.
+ */
+class KMeansClustering::BisectTrial : public ThreadTask
+{
+  public:
+
+	BisectTrial( const ClusterT &samples, unsigned long begin, unsigned long end,
+				 unsigned int seed, Seeding seeding, unsigned int minClusterSize )
+		: sse(0), minClusterSize(minClusterSize), retries(0),
+		  _samples(samples), _begin(begin), _end(end), _seed(seed), _seeding(seeding)
+	{}
+
+	void run()
+		{
+			unsigned int state = _seed, clsize = _end - _begin, cl1_seed, cl2_seed;
+			double dist1, dist2;
+
+			side.assign( clsize, 0 );
+
+			for ( ;; )
+			{
+				// pick random samples as the seeds for the 2 clusters
+				cl1_seed = rand_r( &state ) % clsize;
+				cl2_seed = ( _seeding == KMEANS_PP ) ? pickFar( cl1_seed, state ) : cl1_seed;
+				while ( cl2_seed == cl1_seed )
+				{
+					cl2_seed = rand_r( &state ) % clsize;
+				}
+
+				side[cl1_seed] = 0;
+				side[cl2_seed] = 1;
+				stats1 = ClusterStatistics( at( cl1_seed ) );
+				stats2 = ClusterStatistics( at( cl2_seed ) );
+
+				for ( unsigned int j=0; j < clsize; ++j )
+				{
+					if ( j == cl1_seed   ||  j == cl2_seed ) continue; // already placed
+
+					dist1 = Cluster::getSSE( at(j), stats1.getMean(), Param::InputSampleSize );
+					dist2 = Cluster::getSSE( at(j), stats2.getMean(), Param::InputSampleSize );
+
+					if ( dist2 - dist1 > Util::float_zero ) // add this sample to cluster_1
+					{
+						side[j] = 0;
+						stats1.addSample( at(j) );
+					}
+					else // add this sample to cluster_2
+					{
+						side[j] = 1;
+						stats2.addSample( at(j) );
+					}
+				}
+
+				// We need regularization not to give us one tiny cluster with a few samples
+				// and another with millions of samples. Hence we regularize to make clusters
+				// no smaller than 1% of the original sample size
+				if ( stats1.getCount() >= minClusterSize  &&  stats2.getCount() >= minClusterSize )
+				{
+					break;
+				}
+
+				// if the search is getting too long decrease the
+				// required minimum cluster size with a slight adjustment
+				if ( ++retries % 2 == 0 )
+				{
+					minClusterSize *= 0.99;
+				}
+			}
+
+			// Now we have a bisection.
+			sse = stats1.getSSE() + stats2.getSSE();
+		}
+
+	vector<unsigned char>	side;	// of each sample of the cluster: 0 for cluster_1, 1 for cluster_2
+	ClusterStatistics		stats1, stats2;
+	double					sse;
+	unsigned int			minClusterSize;
+	unsigned int			retries;	// the draws that left a half too small
+
+  private:
+
+	const ClusterT	&_samples;
+	unsigned long	_begin, _end;
+	unsigned int	_seed;
+	Seeding			_seeding;
+	vector<float>	_d2;
+
+	const SampleView &at( unsigned int j ) const { return _samples[ _begin + j ]; }
+
+	// a sample drawn with odds by its squared distance to the first seed; the first seed if all are on it
+	unsigned int pickFar( unsigned int first, unsigned int &state )
+		{
+			unsigned int clsize = _end - _begin, j;
+			double total = 0, u;
+
+			_d2.resize( clsize );
+			for ( j = 0; j < clsize; ++j )
+			{
+				_d2[j] = VectorKernels::squaredDistance( at(j).data(), at(first).data(), Param::InputSampleSize );
+				total += _d2[j];
+			}
+			if ( total == 0 )
+			{
+				return first;
+			}
+
+			u = rand_r( &state ) / ( RAND_MAX + 1.0 ) * total;
+			for ( j = 0; j < clsize; ++j )
+			{
+				u -= _d2[j];
+				if ( u < 0  &&  _d2[j] > 0 ) return j;
+			}
+			for ( j = clsize; j-- > 0; )	// rounding left some over
+			{
+				if ( _d2[j] > 0 ) return j;
+			}
+			return first;
+		}
+};
+
+
+/* Moves the samples of [begin, begin + side.size()) marked 0 to the front of
+ * the range, as in quicksort, and returns where the ones marked 1 start.
+ */
+static unsigned long partition( ClusterT &samples, unsigned long begin, const vector<unsigned char> &side )
+{
+	unsigned long i = 0, j = side.size();
+
+	for ( ;; )
+	{
+		while ( i < j  &&  side[i] == 0 ) ++i;
+		while ( i < j  &&  side[j-1] == 1 ) --j;
+		if ( i >= j ) break;
+
+		swap( samples[ begin + i ], samples[ begin + j - 1 ] );
+		++i;
+		--j;
+	}
+	return begin + i;
+}
+
+
 unsigned long KMeansClustering::bisect()
 {
-	unsigned int clusterToBisect = 0, count = 0, minClusterSize;
-	unsigned long biggestClusterSize = 0;
+	unsigned int clusterToBisect = 0, count = 0, minClusterSize, best = 0;
+	unsigned long biggestClusterSize = 0, begin, end, middle, retries = 0;
 	list<Cluster>::iterator cli = _clusters.begin(), i;
 	list<Cluster>::iterator biggestcli = _clusters.begin();
-	int cl1_seed, cl2_seed;
-	//float distance, seed_distance;
-	int clsize;
-	KMeansClustering bisection, cl;
-	ClusterT C1, C2;
+	vector<BisectTrial> trials;
+	vector<ThreadTask *> tasks;
 
 	// Pick the cluster with the biggest SSE to bisect
 	cout<< "Clusters: [ size, SSE ]"<< endl;
@@ -206,114 +464,82 @@ unsigned long KMeansClustering::bisect()
 					 + " to bisect with SSE " + Util::ftoa( cli->getSSE() )
 					 + " and size " + Util::itoa( cli->getSize() ) + "." );
 
+	if ( cli->getSize() < 2 )
+	{
+		throw domain_error("[KMeansClustering::bisect()] Cannot bisect a cluster of fewer than 2 samples.");
+	}
 
-	count = 0;
-	clsize = cli->getSize();
-	minClusterSize = clsize * 0.01;
-	/* repeat bisection from here for N iterations and pick the best bisection */
+	/* run N trial bisections side by side and pick the best bisection */
+	begin = cli->getBegin();
+	end = cli->getEnd();
+	minClusterSize = cli->getSize() * 0.01;
+	trials.reserve( Param::KMeans_Bisecting_Runs );
 	for ( int n=0; n < Param::KMeans_Bisecting_Runs; ++n )
 	{
-		// pick random samples as the seeds for the 2 clusters
-		cl1_seed = rand() % clsize;
-		do {
-			cl2_seed = rand() % clsize;
-		} while ( cl2_seed == cl1_seed );
-
-
-	//	Util::log( INFO, string( "[KMeansClustering::bisect()] Picked samples ") + Util::itoa( cl1_seed )
-	//					 + " and " + Util::itoa( cl2_seed ) + " as bisecting seeds. " );
-
-
-		ClusterT cluster1( 1, cli->at( cl1_seed ) );
-		ClusterT cluster2( 1, cli->at( cl2_seed ) );
-		Mean mean1( cli->at( cl1_seed ) );
-		Mean mean2( cli->at( cl2_seed ) );
-		double dist1, dist2;
+		trials.push_back( BisectTrial( _samples, begin, end, trialSeed( _seed, _numBisections, n ), _seeding, minClusterSize ) );
+	}
+	for ( unsigned int n=0; n < trials.size(); ++n )
+	{
+		tasks.push_back( &trials[n] );
+	}
+	ThreadPool::getDefault().run( tasks );
+	++_numBisections;
 
-		for (int j=0; j < clsize; ++j )
+	for ( unsigned int n=0; n < trials.size(); ++n )
+	{
+		retries += trials[n].retries;
+		cout<< "Cluster sizes: c1 ["<< trials[n].stats1.getCount()<< "] + c2 ["<< trials[n].stats2.getCount()<< "]";
+		cout<< "\t Bisection SSE: "<< trials[n].sse;
+		if ( trials[n].retries > 0 )
 		{
-			if ( j == cl1_seed   ||  j == cl2_seed ) continue; // already placed
-
-			dist1 = Cluster::getSSE( cli->at(j), mean1.getMean(), Param::InputSampleSize );
-			dist2 = Cluster::getSSE( cli->at(j), mean2.getMean(), Param::InputSampleSize );
-
-			if ( dist2 - dist1 > Util::float_zero ) // add this sample to cluster_1
-			{
-				cluster1.push_back( cli->at(j) );
-				mean1.addSample( cli->at(j) );
-			}
-			else // add this sample to cluster_2
-			{
-				cluster2.push_back( cli->at(j) );
-				mean2.addSample( cli->at(j) );
-			}
+			cout<< "\t after "<< trials[n].retries<< " too small, minimum cluster size: -- "
+				<< trials[n].minClusterSize<< " --";
 		}
 
-		// Now we have a bicsection.
-		cl.clear();
-		cl.addCluster( cluster1, mean1 );
-		cl.addCluster( cluster2, mean2 );
-
-		cout<< "Cluster sizes: c1 ["<< cluster1.size()<< "] + c2 ["<< cluster2.size()<< "]";
-		cout<< "\t Bisection SSE: "<< cl.getSSE();
-
-		if ( cluster1.size() < minClusterSize  ||  cluster2.size() < minClusterSize )
-		{
-			// We need regularization not to ive us one tiny cluster with a few samples
-			// and another with millions of samples. Hence we regularize to make clusters
-			// no smaller than 1% of the original sample size
-			--n;
-			++count;	// count the too small clustring runs
-
-			// if the search is getting too long decrease the
-			// required minimum cluster size with a slight adjustment
-			if ( count % (2 * Param::KMeans_Bisecting_Runs) == 0 )
-			{
-				minClusterSize *= 0.99;
-				cout<< "\n[KMeansClustering::bisect()] set minimum cluster size to: -- "<< minClusterSize << " --";
-			}
-		}
-		else if ( n==0  ||  bisection.getSSE() - cl.getSSE() > Util::float_zero )
+		if ( n==0  ||  trials[best].sse - trials[n].sse > Util::float_zero )
 		{
 			cout<< "  ***  ";
-
-			bisection.clear();
-			bisection.addCluster( cluster1, mean1 );
-			bisection.addCluster( cluster2, mean2 );
-			C1.assign( cluster1.begin(), cluster1.end() );
-			C2.assign( cluster2.begin(), cluster2.end() );
+			best = n;
 		}
 		cout<< endl;
-
 	}
 
+	_numRetries += retries;
+	Util::log( INFO, string("[KMeansClustering::bisect()] Passes retried for a half too small: ") + Util::itoa( retries ) );
 	Util::log( INFO, string("[KMeansClustering::bisect()] Previous SSE: ") + Util::ftoa( getSSE() ) );
 
 
 	biggestClusterSize = ( cli == biggestcli ) ? 0 : biggestcli->getSize();
+	if ( _treeNodes.size() == _clusters.size() )
+	{
+		unsigned int node = _tree.split( _treeNodes[clusterToBisect], trials[best].stats1, trials[best].stats2 );
+
+		_treeNodes.erase( _treeNodes.begin() + clusterToBisect );
+		_treeNodes.push_back( node );
+		_treeNodes.push_back( node + 1 );
+	}
 	// delete bisected cluster
 	_clusters.erase( cli );
 	--_numClusters;
 	_sse_set = false;
 	Util::log( INFO, string("[KMeansClustering::bisect()] Bisected Cluster removed. NumClusters: ") + Util::itoa(_clusters.size()) );
 
-	// add the 2 news clusters
-	cout<< "Cluster sizes: c1 ["<< bisection.getClusterAt(0)->getSize()
-			<< "] + c2 ["<< bisection.getClusterAt(1)->getSize()<< "]"<< endl;
-//	cout<< "Bisection SSE: "<< bisection.getSSE()<< endl;
-	_clusters.push_back( *bisection.getClusterAt(0) );
-	_clusters.push_back( *bisection.getClusterAt(1) );
+	// split its samples in place and add the 2 new clusters over the halves
+	middle = partition( _samples, begin, trials[best].side );
+	_clusters.push_back( Cluster( _samples, begin, middle, trials[best].stats1 ) );
+	_clusters.push_back( Cluster( _samples, middle, end, trials[best].stats2 ) );
 	_numClusters += 2;
 	_sse_set = false;
 
+	cout<< "Cluster sizes: c1 ["<< middle - begin << "] + c2 ["<< end - middle << "]"<< endl;
 
-	if ( bisection.getClusterAt(0)->getSize() > biggestClusterSize )
+	if ( middle - begin > biggestClusterSize )
 	{
-		biggestClusterSize = bisection.getClusterAt(0)->getSize();
+		biggestClusterSize = middle - begin;
 	}
-	if ( bisection.getClusterAt(1)->getSize() > biggestClusterSize )
+	if ( end - middle > biggestClusterSize )
 	{
-		biggestClusterSize = bisection.getClusterAt(1)->getSize();
+		biggestClusterSize = end - middle;
 	}
 
 	Util::log( INFO, string("[KMeansClustering::bisect()] New Clusters added. Clustering size: ") + Util::itoa(_clusters.size()) );
@@ -330,7 +556,20 @@ void KMeansClustering::bisectingKMeansClustering( unsigned int k  )
 {
 	unsigned int biggestClusterSize = 0, i=0;
 
-	srand( time(NULL) );
+	if ( _seed == 0 )
+	{
+		_seed = time(NULL);
+	}
+	Util::log( INFO, string( "[KMeansClustering::bisectingKMeansClustering()] Seed: ") + Util::itoa(_seed)
+					 + ( _seeding == KMEANS_PP ? ", k-means++ seeding." : ", uniform seeding." ) );
+
+	// a fresh clustering: the tree starts again from the whole set
+	if ( _clusters.size() == 1 )
+	{
+		_tree.clear();
+		_tree.setRoot( _clusters.front().getStatistics() );
+		_treeNodes.assign( 1, 0 );
+	}
 	do
 	{
 		biggestClusterSize = bisect();
@@ -339,6 +578,634 @@ void KMeansClustering::bisectingKMeansClustering( unsigned int k  )
 		Util::log( INFO, string("[KMeansClustering::bisectingKMeansClustering()] We have clusters: ") + Util::itoa(_numClusters) );
 	}
 	while (  i < k-1  &&  biggestClusterSize > 0.01 * _numSamples );
+
+	Util::log( INFO, string("[KMeansClustering::bisectingKMeansClustering()] Passes retried for a half too small: ")
+					 + Util::itoa( _numRetries ) + "." );
+
+	if ( _treeNodes.size() == _clusters.size() )
+	{
+		_tree.setMaxK( max( k, _tree.getMaxK() ) );
+	}
+}
+
+
+// The samples are split into this many chunks for the Lloyd iterations, whatever the number of threads.
+static const unsigned int LloydChunks = 64;
+
+static inline float sampleDistance( const float *a, const float *b )
+{
+	return sqrt( VectorKernels::squaredDistance( a, b, Param::InputSampleSize ) );
+}
+
+
+/* One assignment pass of Hamerly's algorithm over a chunk of the samples.
+ * A sample keeps its centre without a look if its upper bound is within the
+ * lower bound on the second closest, or half the distance to the centre's
+ * nearest other; else its upper bound is made exact, and only if that still
+ * fails are all the centres measured.
+ */
+class KMeansClustering::LloydTask : public RangeTask
+{
+  public:
+
+	LloydTask( const ClusterT &samples, const AlignedArray &centres, unsigned int numCentres,
+			   const vector<float> &halfGap, vector<unsigned int> &assign,
+			   vector<float> &upper, vector<float> &lower, unsigned int numChunks )
+		: computed( numChunks, 0 ), moves( numChunks ),
+		  _samples(samples), _centres(centres), _numCentres(numCentres), _halfGap(halfGap),
+		  _assign(assign), _upper(upper), _lower(lower)
+	{}
+
+	void run( unsigned long begin, unsigned long end, unsigned int chunk )
+		{
+			unsigned int ldc = AlignedArray::stride( Param::InputSampleSize ), a, best, j;
+			float bound, d, d1, d2;
+			const float *x;
+
+			for ( unsigned long i = begin; i < end; ++i )
+			{
+				a = _assign[i];
+				bound = max( _halfGap[a], _lower[i] );
+				if ( _upper[i] <= bound ) continue;
+
+				x = _samples[i].data();
+				_upper[i] = sampleDistance( x, _centres.data() + (unsigned long)a * ldc );
+				++computed[chunk];
+				if ( _upper[i] <= bound ) continue;
+
+				best = a;
+				d1 = _upper[i];
+				d2 = FLT_MAX;
+				for ( j = 0; j < _numCentres; ++j )
+				{
+					if ( j == a ) continue;
+
+					d = sampleDistance( x, _centres.data() + (unsigned long)j * ldc );
+					if ( d < d1 )
+					{
+						d2 = d1;
+						d1 = d;
+						best = j;
+					}
+					else if ( d < d2 )
+					{
+						d2 = d;
+					}
+				}
+				computed[chunk] += _numCentres - 1;
+
+				_upper[i] = d1;
+				_lower[i] = d2;
+				if ( best != a )
+				{
+					moves[chunk].push_back( make_pair( i, a ) );	// from a to _assign[i]
+					_assign[i] = best;
+				}
+			}
+		}
+
+	vector<unsigned long>							computed;	// distances, per chunk
+	vector< vector< pair<unsigned long, unsigned int> > >	moves;		// sample and old centre, per chunk
+
+  private:
+
+	const ClusterT			&_samples;
+	const AlignedArray		&_centres;
+	unsigned int			_numCentres;
+	const vector<float>		&_halfGap;
+	vector<unsigned int>	&_assign;
+	vector<float>			&_upper;
+	vector<float>			&_lower;
+};
+
+
+unsigned int KMeansClustering::refine( unsigned int maxIterations )
+{
+	const unsigned int K = _clusters.size(), ldc = AlignedArray::stride( Param::InputSampleSize );
+	const unsigned long N = _samples.size();
+	unsigned int it = 0, j, j2, far1 = 0, numChunks, numMoved = 0;
+	unsigned long i, computed = 0;
+	list<Cluster>::iterator cli;
+	vector<ClusterStatistics> stats;
+	AlignedArray centres( (unsigned long)K * ldc );
+	vector<float> halfGap( K ), shift( K ), upper( N ), lower( N, 0.0f );
+	vector<unsigned int> assign( N );
+	float d, shift1, shift2;
+
+	if ( K < 2  ||  N == 0  ||  maxIterations == 0 )
+	{
+		return 0;
+	}
+	for ( cli = _clusters.begin(); cli != _clusters.end(); cli++ )
+	{
+		if ( !cli->hasSamples() )
+		{
+			Util::log( ERROR, "[KMeansClustering::refine()] The clusters have no samples to refine." );
+			return 0;
+		}
+	}
+	numChunks = min( (unsigned long)LloydChunks, N );
+
+	// start from the bisection
+	for ( cli = _clusters.begin(), j = 0; cli != _clusters.end(); cli++, ++j )
+	{
+		stats.push_back( cli->getStatistics() );
+		copy( stats[j].getMean().begin(), stats[j].getMean().begin() + Param::InputSampleSize,
+			  centres.data() + (unsigned long)j * ldc );
+		for ( i = cli->getBegin(); i < cli->getEnd(); ++i )
+		{
+			assign[i] = j;
+			upper[i] = sampleDistance( _samples[i].data(), centres.data() + (unsigned long)j * ldc );
+		}
+	}
+	computed += N;
+
+	for ( it = 0; it < maxIterations; ++it )
+	{
+		// half the distance from each centre to its nearest other
+		fill( halfGap.begin(), halfGap.end(), FLT_MAX );
+		for ( j = 0; j < K; ++j )
+		{
+			for ( j2 = j + 1; j2 < K; ++j2 )
+			{
+				d = sampleDistance( centres.data() + (unsigned long)j * ldc, centres.data() + (unsigned long)j2 * ldc ) / 2;
+				halfGap[j] = min( halfGap[j], d );
+				halfGap[j2] = min( halfGap[j2], d );
+			}
+		}
+
+		LloydTask task( _samples, centres, K, halfGap, assign, upper, lower, numChunks );
+		ThreadPool::getDefault().parallelFor( N, task, numChunks );
+
+		// move the samples between the statistics, in chunk order
+		numMoved = 0;
+		for ( unsigned int c = 0; c < numChunks; ++c )
+		{
+			computed += task.computed[c];
+			for ( unsigned int m = 0; m < task.moves[c].size(); ++m )
+			{
+				i = task.moves[c][m].first;
+				stats[ task.moves[c][m].second ].removeSample( _samples[i] );
+				stats[ assign[i] ].addSample( _samples[i] );
+			}
+			numMoved += task.moves[c].size();
+		}
+
+		Util::log( INFO, string("[KMeansClustering::refine()] Iteration ") + Util::itoa( it + 1 )
+						 + ": " + Util::itoa( numMoved ) + " samples moved." );
+		if ( numMoved == 0 )
+		{
+			break;
+		}
+
+		// move the centres, and loosen the bounds by as far as they went
+		shift1 = shift2 = 0;
+		for ( j = 0; j < K; ++j )
+		{
+			shift[j] = 0;
+			if ( stats[j].getCount() == 0 ) continue;	// an empty cluster keeps its centre
+
+			shift[j] = sampleDistance( centres.data() + (unsigned long)j * ldc, &stats[j].getMean()[0] );
+			copy( stats[j].getMean().begin(), stats[j].getMean().begin() + Param::InputSampleSize,
+				  centres.data() + (unsigned long)j * ldc );
+			if ( shift[j] > shift1 )
+			{
+				shift2 = shift1;
+				shift1 = shift[j];
+				far1 = j;
+			}
+			else if ( shift[j] > shift2 )
+			{
+				shift2 = shift[j];
+			}
+		}
+		for ( i = 0; i < N; ++i )
+		{
+			upper[i] += shift[ assign[i] ];
+			lower[i] -= ( assign[i] == far1 ) ? shift2 : shift1;
+		}
+	}
+
+	if ( numMoved == 0 )
+	{
+		++it;	// the last pass counts too
+	}
+	Util::log( INFO, string("[KMeansClustering::refine()] ")
+					 + ( numMoved == 0 ? "Converged after " : "Stopped unconverged after " )
+					 + Util::itoa( it ) + " iterations; computed " + Util::itoa( computed )
+					 + " sample distances, skipped " + Util::ftoa( 100.0 - 100.0 * computed / ( (double)N * K * it ) )
+					 + "% of those of plain Lloyd." );
+
+	regroup( assign, K );
+
+	Util::log( INFO, string("[KMeansClustering::refine()] New SSE: ") + Util::ftoa( getSSE() ) );
+
+	return it;
+}
+
+
+void KMeansClustering::regroup( const vector<unsigned int> &assign, unsigned int numClusters )
+{
+	const unsigned long N = _samples.size();
+	vector<unsigned long> offsets( numClusters + 1, 0 );
+	unsigned long i, begin, end;
+	ClusterT sorted;
+
+	// a counting sort, so each cluster's samples keep their order
+	for ( i = 0; i < N; ++i )
+	{
+		++offsets[ assign[i] + 1 ];
+	}
+	for ( unsigned int j = 0; j < numClusters; ++j )
+	{
+		offsets[j+1] += offsets[j];
+	}
+	sorted.resize( N );
+	for ( i = 0; i < N; ++i )
+	{
+		sorted[ offsets[ assign[i] ]++ ] = _samples[i];
+	}
+	_samples.swap( sorted );
+
+	_clusters.clear();
+	_treeNodes.clear();
+	begin = 0;
+	for ( unsigned int j = 0; j < numClusters; ++j, begin = end )
+	{
+		end = offsets[j];		// now the end of cluster j
+		if ( end == begin )
+		{
+			Util::log( INFO, string("[KMeansClustering::regroup()] Dropped empty cluster ") + Util::itoa( j ) + "." );
+			continue;
+		}
+		_clusters.push_back( Cluster( _samples, begin, end ) );
+	}
+	_numClusters = _clusters.size();
+	_sse_set = false;
+}
+
+
+// The nearest centre to each of a batch of samples, and the distance to it.
+class KMeansClustering::NearestTask : public RangeTask
+{
+  public:
+
+	NearestTask( const ClusterT &samples, const vector<unsigned long> &batch,
+				 const AlignedArray &centres, unsigned int numCentres )
+		: nearest( batch.size() ), dist( batch.size() ),
+		  _samples(samples), _batch(batch), _centres(centres), _numCentres(numCentres)
+	{}
+
+	void run( unsigned long begin, unsigned long end, unsigned int )
+		{
+			unsigned int ldc = AlignedArray::stride( Param::InputSampleSize );
+			float d;
+
+			for ( unsigned long b = begin; b < end; ++b )
+			{
+				const float *x = _samples[ _batch[b] ].data();
+
+				nearest[b] = 0;
+				dist[b] = FLT_MAX;
+				for ( unsigned int j = 0; j < _numCentres; ++j )
+				{
+					d = VectorKernels::squaredDistance( x, _centres.data() + (unsigned long)j * ldc, Param::InputSampleSize );
+					if ( d < dist[b] )
+					{
+						dist[b] = d;
+						nearest[b] = j;
+					}
+				}
+			}
+		}
+
+	vector<unsigned int>	nearest;
+	vector<float>			dist;		// squared
+
+  private:
+
+	const ClusterT					&_samples;
+	const vector<unsigned long>		&_batch;
+	const AlignedArray				&_centres;
+	unsigned int					_numCentres;
+};
+
+
+unsigned int KMeansClustering::miniBatchKMeansClustering( unsigned int k, unsigned int batchSize, unsigned int maxBatches )
+{
+	const unsigned int ldc = AlignedArray::stride( Param::InputSampleSize );
+	const unsigned long N = _samples.size();
+	unsigned int state, it, j, calm = 0, numChunks;
+	unsigned long b;
+	vector<ClusterStatistics> stats;
+	vector<unsigned long> batch( batchSize ), seeds;
+	AlignedArray centres( (unsigned long)k * ldc );
+	double meanDist = 0;
+	float shift, maxShift = 0;
+
+	if ( k < 2  ||  N < k  ||  batchSize == 0 )
+	{
+		throw domain_error("[KMeansClustering::miniBatchKMeansClustering()] Need at least 2 means and as many samples.");
+	}
+	if ( _seed == 0 )
+	{
+		_seed = time(NULL);
+	}
+	Util::log( INFO, string( "[KMeansClustering::miniBatchKMeansClustering()] Seed: ") + Util::itoa(_seed)
+					 + ", batches of " + Util::itoa( batchSize ) + "." );
+	state = _seed;
+
+	// k distinct samples to start from
+	while ( seeds.size() < k )
+	{
+		b = randomIndex( state, N );
+		if ( find( seeds.begin(), seeds.end(), b ) == seeds.end() )
+		{
+			seeds.push_back( b );
+			stats.push_back( ClusterStatistics( _samples[b] ) );
+		}
+	}
+
+	numChunks = min( LloydChunks, batchSize );
+	for ( it = 0; it < maxBatches  &&  calm < Param::KMeans_MiniBatch_Patience; ++it )
+	{
+		for ( j = 0; j < k; ++j )
+		{
+			copy( stats[j].getMean().begin(), stats[j].getMean().begin() + Param::InputSampleSize,
+				  centres.data() + (unsigned long)j * ldc );
+		}
+		for ( b = 0; b < batchSize; ++b )
+		{
+			batch[b] = randomIndex( state, N );
+		}
+
+		// assign the batch to the means as they were, then move them a sample at a time
+		NearestTask task( _samples, batch, centres, k );
+		ThreadPool::getDefault().parallelFor( batchSize, task, numChunks );
+
+		meanDist = 0;
+		for ( b = 0; b < batchSize; ++b )
+		{
+			stats[ task.nearest[b] ].addSample( _samples[ batch[b] ] );		// the rate is 1 / count
+			meanDist += sqrt( task.dist[b] );
+		}
+		meanDist /= batchSize;
+
+		maxShift = 0;
+		for ( j = 0; j < k; ++j )
+		{
+			shift = sampleDistance( centres.data() + (unsigned long)j * ldc, &stats[j].getMean()[0] );
+			maxShift = max( maxShift, shift );
+		}
+		calm = ( maxShift <= Param::KMeans_MiniBatch_Tolerance * meanDist ) ? calm + 1 : 0;
+	}
+
+	Util::log( INFO, string("[KMeansClustering::miniBatchKMeansClustering()] ")
+					 + ( calm >= Param::KMeans_MiniBatch_Patience ? "Converged after " : "Stopped unconverged after " )
+					 + Util::itoa( it ) + " batches; last largest move of a mean " + Util::ftoa( maxShift )
+					 + " against a mean distance of " + Util::ftoa( meanDist ) + "." );
+
+	_clusters.clear();
+	_treeNodes.clear();
+	for ( j = 0; j < k; ++j )
+	{
+		_clusters.push_back( Cluster( _samples, stats[j] ) );
+	}
+	_numClusters = k;
+	_sse_set = false;
+
+	return it;
+}
+
+
+// Brings each sample's squared distance to its closest seed up to date with the seeds [first, last).
+class KMeansClustering::CostTask : public RangeTask
+{
+  public:
+
+	CostTask( const ClusterT &samples, const vector<unsigned long> &seeds, unsigned long first,
+			  vector<float> &d2, vector<unsigned long> &closest, unsigned int numChunks )
+		: partial( numChunks, 0.0 ),
+		  _samples(samples), _seeds(seeds), _first(first), _d2(d2), _closest(closest)
+	{}
+
+	void run( unsigned long begin, unsigned long end, unsigned int chunk )
+		{
+			float d;
+
+			for ( unsigned long i = begin; i < end; ++i )
+			{
+				for ( unsigned long s = _first; s < _seeds.size(); ++s )
+				{
+					d = VectorKernels::squaredDistance( _samples[i].data(), _samples[ _seeds[s] ].data(),
+														Param::InputSampleSize );
+					if ( d < _d2[i] )
+					{
+						_d2[i] = d;
+						_closest[i] = s;
+					}
+				}
+				partial[chunk] += _d2[i];
+			}
+		}
+
+	vector<double>	partial;	// the cost of each chunk
+
+  private:
+
+	const ClusterT					&_samples;
+	const vector<unsigned long>		&_seeds;
+	unsigned long					_first;
+	vector<float>					&_d2;
+	vector<unsigned long>			&_closest;
+};
+
+
+/* One k-means|| round: takes each sample with probability l d2 / cost.
+ * Each chunk draws from a generator of its own, so the picks do not depend
+ * on the number of threads.
+ */
+class KMeansClustering::OversampleTask : public RangeTask
+{
+  public:
+
+	OversampleTask( const vector<float> &d2, double l, double cost,
+					unsigned int seed, unsigned int round, unsigned int numChunks )
+		: picks( numChunks ), _d2(d2), _l(l), _cost(cost), _seed(seed), _round(round)
+	{}
+
+	void run( unsigned long begin, unsigned long end, unsigned int chunk )
+		{
+			unsigned int state = trialSeed( _seed, _round, chunk );
+
+			for ( unsigned long i = begin; i < end; ++i )
+			{
+				if ( rand_r( &state ) / ( RAND_MAX + 1.0 ) < _l * _d2[i] / _cost )
+				{
+					picks[chunk].push_back( i );
+				}
+			}
+		}
+
+	vector< vector<unsigned long> >	picks;
+
+  private:
+
+	const vector<float>	&_d2;
+	double				_l, _cost;
+	unsigned int		_seed, _round;
+};
+
+
+void KMeansClustering::kMeansParallelSeeds( unsigned int k, vector<unsigned long> &seeds )
+{
+	const unsigned long N = _samples.size();
+	const unsigned int numChunks = min( (unsigned long)LloydChunks, N );
+	unsigned int state = _seed, r;
+	unsigned long i, c, first = 0, C;
+	vector<float> d2( N, FLT_MAX ), cd2;
+	vector<unsigned long> closest( N, 0 ), candidates;
+	vector<double> weight;
+	double cost = 0, total, u;
+	float d;
+
+	seeds.clear();
+	candidates.push_back( randomIndex( state, N ) );
+
+	for ( r = 0; ; ++r )
+	{
+		CostTask costs( _samples, candidates, first, d2, closest, numChunks );
+		ThreadPool::getDefault().parallelFor( N, costs, numChunks );
+		cost = 0;
+		for ( c = 0; c < numChunks; ++c )
+		{
+			cost += costs.partial[c];
+		}
+		if ( r == Param::KMeans_Parallel_Rounds  ||  cost == 0 )
+		{
+			break;
+		}
+
+		OversampleTask oversample( d2, (double)Param::KMeans_Parallel_Oversampling * k, cost, _seed, r, numChunks );
+		ThreadPool::getDefault().parallelFor( N, oversample, numChunks );
+		first = candidates.size();
+		for ( c = 0; c < numChunks; ++c )
+		{
+			candidates.insert( candidates.end(), oversample.picks[c].begin(), oversample.picks[c].end() );
+		}
+		Util::log( INFO, string("[KMeansClustering::kMeansParallelSeeds()] Round ") + Util::itoa( r + 1 )
+						 + ": cost " + Util::ftoa( cost ) + ", " + Util::itoa( candidates.size() ) + " candidates." );
+	}
+
+	// weigh each candidate by the samples closest to it, then k-means++ over the candidates
+	C = candidates.size();
+	weight.assign( C, 0.0 );
+	for ( i = 0; i < N; ++i )
+	{
+		weight[ closest[i] ] += 1;
+	}
+
+	cd2.assign( C, FLT_MAX );		// the first by weight alone
+	while ( seeds.size() < k  &&  seeds.size() < C )
+	{
+		total = 0;
+		for ( c = 0; c < C; ++c )
+		{
+			total += weight[c] * cd2[c];
+		}
+
+		if ( total == 0 )
+		{
+			break;		// the candidates left are all seeds already
+		}
+		u = rand_r( &state ) / ( RAND_MAX + 1.0 ) * total;
+		for ( c = 0; c < C - 1  &&  ( u -= weight[c] * cd2[c] ) >= 0; ++c );
+		while ( cd2[c] == 0 ) --c;		// rounding at the end of the walk
+
+		seeds.push_back( candidates[c] );
+		for ( i = 0; i < C; ++i )
+		{
+			d = VectorKernels::squaredDistance( _samples[ candidates[i] ].data(), _samples[ candidates[c] ].data(),
+												Param::InputSampleSize );
+			cd2[i] = min( cd2[i], d );
+		}
+	}
+
+	// too few candidates, or too few distinct ones: make up the rest at random
+	while ( seeds.size() < k )
+	{
+		i = randomIndex( state, N );
+		if ( find( seeds.begin(), seeds.end(), i ) == seeds.end() )
+		{
+			seeds.push_back( i );
+		}
+	}
+}
+
+
+void KMeansClustering::lloydKMeansClustering( unsigned int k )
+{
+	const unsigned int ldc = AlignedArray::stride( Param::InputSampleSize );
+	const unsigned long N = _samples.size();
+	vector<unsigned long> seeds, all( N );
+	vector<unsigned int> assign( N );
+	AlignedArray centres( (unsigned long)k * ldc );
+	unsigned long i;
+	unsigned int j, its;
+
+	if ( k < 2  ||  N < k )
+	{
+		throw domain_error("[KMeansClustering::lloydKMeansClustering()] Need at least 2 means and as many samples.");
+	}
+	if ( _seed == 0 )
+	{
+		_seed = time(NULL);
+	}
+	Util::log( INFO, string( "[KMeansClustering::lloydKMeansClustering()] Seed: ") + Util::itoa(_seed) );
+
+	kMeansParallelSeeds( k, seeds );
+	for ( j = 0; j < k; ++j )
+	{
+		copy( _samples[ seeds[j] ].data(), _samples[ seeds[j] ].data() + Param::InputSampleSize,
+			  centres.data() + (unsigned long)j * ldc );
+	}
+
+	for ( i = 0; i < N; ++i )
+	{
+		all[i] = i;
+	}
+	NearestTask task( _samples, all, centres, k );
+	ThreadPool::getDefault().parallelFor( N, task, min( (unsigned long)LloydChunks, N ) );
+	for ( i = 0; i < N; ++i )
+	{
+		assign[i] = task.nearest[i];
+	}
+	regroup( assign, k );
+
+	its = refine();
+	Util::log( INFO, string("[KMeansClustering::lloydKMeansClustering()] ") + Util::itoa( _numClusters )
+					 + " clusters after " + Util::itoa( its ) + " Lloyd iterations." );
+}
+
+
+void KMeansClustering::cluster( unsigned int k, Method method )
+{
+	if ( method == MINI_BATCH )
+	{
+		miniBatchKMeansClustering( k );
+		return;
+	}
+	if ( method == LLOYD )
+	{
+		lloydKMeansClustering( k );
+		return;
+	}
+
+	bisectingKMeansClustering( k );
+	if ( method == BISECTING_REFINED )
+	{
+		refine();
+	}
 }
 
 
@@ -363,3 +1230,220 @@ unsigned int KMeansClustering::getKMeans( vector< vector<float> > &meansVec )
 
 
 
+
+
+
+unsigned long long KMeansClustering::getTreeKey() const
+{
+	unsigned long long key = Util::HashSeed;
+	unsigned long n = _samples.size();
+	int params[] = { Param::InputSampleSize, Param::KMeans_Bisecting_Runs, _seeding, (int)_seed };
+
+	key = Util::hashBytes( key, params, sizeof(params) );
+	key = Util::hashBytes( key, &n, sizeof(n) );
+	for ( unsigned long i = 0; i < n; ++i )
+	{
+		key = Util::hashBytes( key, _samples[i].data(), ( Param::InputSampleSize + 1 ) * sizeof(float) );
+	}
+	return key;
+}
+
+
+void KMeansClustering::cutTree( unsigned int k )
+{
+	vector<unsigned int> leaves;
+
+	_tree.cut( k, leaves );
+	_clusters.clear();
+	_treeNodes.clear();
+	for ( unsigned int j = 0; j < leaves.size(); ++j )
+	{
+		_clusters.push_back( Cluster( _samples, _tree.getNode( leaves[j] ).stats ) );
+	}
+	_numClusters = _clusters.size();
+	_sse_set = false;
+
+	Util::log( INFO, string("[KMeansClustering::cutTree()] Cut ") + Util::itoa( _numClusters )
+					 + " clusters from a tree of " + Util::itoa( _tree.getNumSplits() ) + " bisections." );
+}
+
+
+
+
+static const char			TreeMagic[8]	= { 'N', 'T', 'B', 'T', 'R', 'E', 'E', '\0' };
+static const unsigned int	TreeVersion		= 1;
+
+
+/* Tree file layout: this header, then for each node its parent, split and
+ * count, and the dimension's running means and sums of squared deviations.
+ */
+struct TreeHeader
+{
+	char				magic[8];
+	unsigned int		version;
+	unsigned int		dimension;
+	unsigned long long	key;
+	unsigned int		maxK;
+	unsigned int		numNodes;
+};
+
+
+void BisectionTree::setRoot( const ClusterStatistics &stats )
+{
+	Node root = { stats, -1, -1 };
+
+	_nodes.assign( 1, root );
+}
+
+
+unsigned int BisectionTree::split( unsigned int n, const ClusterStatistics &stats1, const ClusterStatistics &stats2 )
+{
+	Node child = { stats1, (int)n, -1 };
+
+	if ( n >= _nodes.size()  ||  _nodes[n].split >= 0 )
+	{
+		throw invalid_argument("[BisectionTree::split()] Not a leaf of the tree.");
+	}
+	_nodes[n].split = getNumSplits();
+	_nodes.push_back( child );
+	child.stats = stats2;
+	_nodes.push_back( child );
+
+	return _nodes.size() - 2;
+}
+
+
+void BisectionTree::cut( unsigned int k, vector<unsigned int> &leaves ) const
+{
+	// the first k-1 splits make nodes [0, 2k-1); a leaf of them is one not split among those
+	int numSplits = min( (unsigned int)max( (int)k - 1, 0 ), getNumSplits() );
+
+	leaves.clear();
+	for ( int n = 0; n < 2 * numSplits + 1  &&  n < (int)_nodes.size(); ++n )
+	{
+		if ( _nodes[n].split < 0  ||  _nodes[n].split >= numSplits )
+		{
+			leaves.push_back( n );
+		}
+	}
+}
+
+
+// The header, then each node of the tree.
+class TreeWriter: public Util::FileWriter
+{
+  public:
+
+	TreeWriter( const TreeHeader &h, const vector<BisectionTree::Node> &nodes ) : _h(h), _nodes(nodes) {}
+
+	bool write( FILE *f )
+	{
+		bool ok = fwrite( &_h, sizeof(_h), 1, f ) == 1;
+
+		for ( unsigned int n = 0; n < _nodes.size()  &&  ok; ++n )
+		{
+			const ClusterStatistics &s = _nodes[n].stats;
+			unsigned long long count = s.getCount();
+
+			ok = fwrite( &_nodes[n].parent, sizeof(int), 1, f ) == 1
+				 &&  fwrite( &_nodes[n].split, sizeof(int), 1, f ) == 1
+				 &&  fwrite( &count, sizeof(count), 1, f ) == 1
+				 &&  fwrite( &s.getMeanSums()[0], sizeof(double), _h.dimension, f ) == _h.dimension
+				 &&  fwrite( &s.getM2()[0], sizeof(double), _h.dimension, f ) == _h.dimension;
+		}
+		return ok;
+	}
+
+
+  private:
+
+	const TreeHeader					&_h;
+	const vector<BisectionTree::Node>	&_nodes;
+
+};
+
+
+bool BisectionTree::save( const string &path, unsigned long long key ) const
+{
+	string dir = path.substr( 0, path.rfind( '/' ) );
+	TreeHeader h;
+
+	if ( path.rfind( '/' ) != string::npos  &&  mkdir( dir.c_str(), 0755 ) != 0  &&  errno != EEXIST )
+	{
+		Util::log( ERROR, "[BisectionTree::save()] Cannot create the directory: " + dir );
+		return false;
+	}
+
+	memset( &h, 0, sizeof(h) );
+	memcpy( h.magic, TreeMagic, sizeof(TreeMagic) );
+	h.version	= TreeVersion;
+	h.dimension	= _nodes.empty() ? 0 : _nodes[0].stats.getDimension();
+	h.key		= key;
+	h.maxK		= _maxK;
+	h.numNodes	= _nodes.size();
+
+	TreeWriter writer( h, _nodes );
+	return Util::writeFile( path, writer, "tree file" );
+}
+
+
+bool BisectionTree::load( const string &path, unsigned long long key )
+{
+	TreeHeader h;
+	vector<double> mean, m2;
+	unsigned long long count, record;
+	struct stat st;
+	Node node;
+	bool ok;
+	FILE *f;
+
+	clear();
+	f = fopen( path.c_str(), "rb" );
+	if ( !f )
+	{
+		return false;
+	}
+
+	// a file cut short or of other samples is grown again; nothing is sized from its header until it checks out
+	ok = fstat( fileno( f ), &st ) == 0
+		 &&  fread( &h, sizeof(h), 1, f ) == 1
+		 &&  Util::hasTag( &h, TreeMagic, TreeVersion )
+		 &&  h.dimension == (unsigned int)Param::InputSampleSize + 1  &&  h.key == key
+		 &&  h.numNodes % 2 == 1;
+	if ( ok )
+	{
+		record = 2 * sizeof(int) + sizeof(count) + 2ULL * h.dimension * sizeof(double);
+		ok = (unsigned long long)st.st_size == sizeof(h) + h.numNodes * record;
+	}
+	if ( !ok )
+	{
+		fclose( f );
+		return false;
+	}
+
+	mean.resize( h.dimension );
+	m2.resize( h.dimension );
+	for ( unsigned int n = 0; n < h.numNodes  &&  ok; ++n )
+	{
+		ok = fread( &node.parent, sizeof(int), 1, f ) == 1
+			 &&  fread( &node.split, sizeof(int), 1, f ) == 1
+			 &&  fread( &count, sizeof(count), 1, f ) == 1
+			 &&  fread( &mean[0], sizeof(double), h.dimension, f ) == h.dimension
+			 &&  fread( &m2[0], sizeof(double), h.dimension, f ) == h.dimension
+			 &&  node.parent < (int)n  &&  node.split < (int)h.numNodes / 2;
+		if ( ok )
+		{
+			node.stats.set( count, &mean[0], &m2[0] );
+			_nodes.push_back( node );
+		}
+	}
+	fclose( f );
+
+	if ( !ok )
+	{
+		clear();
+		return false;
+	}
+	_maxK = h.maxK;
+	return true;
+}
@@ -10,103 +10,173 @@
 
 #include <vector>
 #include <list>
+#include <string>
 #include <stdexcept>
 
+#include "SampleStore.h"
+
 
 using namespace std;
 
 
-typedef vector< vector<float> > ClusterT;
+typedef vector<SampleView> ClusterT;
 
 
-class Mean
+/* The count, mean and sum of squared deviations of a set of samples, kept
+ * up to date as samples come and go (Welford), and merged with another set's
+ * exactly (Chan et al.). The SSE and mean are read in O(d).
+ */
+class ClusterStatistics
 {
 public:
 
-
-	Mean( unsigned int size )
-		: _count(0), _mean_acc( size, 0.0 ), _mean( size, 0.0 )
+	ClusterStatistics( unsigned int size = Param::InputSampleSize + 1 )
+		: _count(0), _mean( size, 0.0 ), _m2( size, 0.0 ), _meanf( size, 0.0 )
 	{}
 
-	Mean( vector<float> m )
-		: _count(1), _mean_acc( m.begin(), m.end()), _mean( m.begin(), m.end() )
+	// the statistics of one sample
+	ClusterStatistics( const SampleView &m, unsigned int size = Param::InputSampleSize + 1 )
+		: _count(1), _mean( m.data(), m.data() + size ), _m2( size, 0.0 ), _meanf( m.data(), m.data() + size )
 	{}
 
-	void addSample( vector<float> m );
-	vector<float> getMean() const { return _mean; }
+	void clear();
+
+	void addSample( const SampleView &m );
+	void removeSample( const SampleView &m );
+
+	// Merges in the statistics of another, disjoint set of samples.
+	void add( const ClusterStatistics &s );
+
+	unsigned long getCount() const { return _count; }
+
+	const vector<float> &getMean() const { return _meanf; }
+
+	// sum over the samples of | x - mean |^2
+	double getSSE() const;
+
+	// the running sums themselves, to save and restore them exactly
+	unsigned int getDimension() const			{ return _mean.size(); }
+	const vector<double> &getMeanSums() const	{ return _mean; }
+	const vector<double> &getM2() const			{ return _m2; }
+	void set( unsigned long count, const double *mean, const double *m2 );
 
 private:
 
 	unsigned long	_count;
-	vector<double>  _mean_acc;
-	vector<float> 	_mean;
+	vector<double>  _mean;
+	vector<double>  _m2;		// sum of squared deviations from the mean, per term
+	vector<float> 	_meanf;		// _mean, for the distance kernels
 
 };
 
 
+/* A cluster is the range [begin, end) of the clustering's samples.
+ * The samples of a cluster being bisected are partitioned in place, so that
+ * each half is a range again.
+ */
 class Cluster
 {
 
 public:
 
-	static float getSSE( vector<float> p1, vector<float> p2, unsigned int numItemsToCompare );
+	static float getSSE( const vector<float> &p1, const vector<float> &p2, unsigned int numItemsToCompare );
+	static float getSSE( const SampleView &p1, const vector<float> &p2, unsigned int numItemsToCompare );
+	static float getSSE( const float *p1, const float *p2, unsigned int numItemsToCompare );
 
 
-	Cluster( ClusterT cl )
-		: _cluster(cl), _mean_set(false), _sse_set(false)
-	{ setStatistics(); }
+	Cluster( const ClusterT &samples, unsigned long begin, unsigned long end );
 
-	Cluster( ClusterT &cl, vector<float> m )
-		: _cluster(cl), _mean( m.begin(), m.end() ), _mean_set(true), _sse_set(false)
-	{ setStatistics(); }
+	Cluster( const ClusterT &samples, unsigned long begin, unsigned long end, const ClusterStatistics &stats )
+		: _samples(&samples), _begin(begin), _end(end), _stats(stats)
+	{}
 
-	vector<float> at( unsigned int i )
+	// A cluster known by its statistics only, as mini-batch clustering leaves them.
+	Cluster( const ClusterT &samples, const ClusterStatistics &stats )
+		: _samples(&samples), _begin(0), _end(0), _stats(stats)
+	{}
+
+	const SampleView &at( unsigned int i ) const
 	{
-		_size = _cluster.size();
-		if ( i >= _size )
+		if ( i >= _end - _begin )
 		{
 			throw out_of_range("[Cluster::at()] Index out of range.");
 		}
-		return _cluster.at(i);
+		return (*_samples)[ _begin + i ];
 	}
 
-	unsigned int getSize()
-	{
-		_size = _cluster.size();
-		return _size;
-	}
+	// the samples the statistics cover; those of its range, if it has one
+	unsigned int getSize() const { return _stats.getCount(); }
 
-	float getSSE()
-	{
-		if ( !_sse_set ) setStatistics();
-		return _sse;
-	}
+	bool hasSamples() const { return _end > _begin; }
 
-	vector<float> getMean()
-	{
-		if ( !_mean_set )
-		{
-			cout<< "** Setting Mean **";
-			setStatistics();
-		}
-		return _mean;
-	}
+	unsigned long getBegin() const	{ return _begin; }
+	unsigned long getEnd() const	{ return _end; }
+
+	double getSSE() const { return _stats.getSSE(); }
+
+	vector<float> getMean() const { return _stats.getMean(); }
+
+	const ClusterStatistics &getStatistics() const { return _stats; }
 
 
 private:
 
-	ClusterT	_cluster;
+	const ClusterT	*_samples;		// the clustering's
+	unsigned long	_begin, _end;
+
+	ClusterStatistics	_stats;
 
-	unsigned int 	_size;	// size of cluster
+};
 
-	vector<float>	_mean;	// mean of the clusters
-	bool			_mean_set;
 
-	double			_sse;	// sum-of-squared error
-	bool			_sse_set;
 
+/* The splits of a bisecting clustering, in the order they were made. Node 0
+ * is the whole set; split s makes nodes 2s+1 and 2s+2. Since each bisection
+ * depends only on the ones before it, the leaves after the first k-1 splits
+ * are the clusters a run to k would have made, and they are cut in O(k).
+ */
+class BisectionTree
+{
+  public:
+
+	struct Node
+	{
+		ClusterStatistics	stats;
+		int					parent;
+		int					split;		// the split that divided it; -1 for a leaf
+	};
+
+	BisectionTree() : _maxK(0) {}
+
+	void clear() { _nodes.clear(); _maxK = 0; }
+
+	void setRoot( const ClusterStatistics &stats );
+
+	// Records the next split, of node n; returns the first of its two new nodes.
+	unsigned int split( unsigned int n, const ClusterStatistics &stats1, const ClusterStatistics &stats2 );
 
-	void setStatistics();
+	unsigned int getNumNodes() const	{ return _nodes.size(); }
+	unsigned int getNumSplits() const	{ return _nodes.empty() ? 0 : ( _nodes.size() - 1 ) / 2; }
+	const Node &getNode( unsigned int n ) const	{ return _nodes.at( n ); }
+
+	// the K it was grown for; a clustering may stop splitting before
+	unsigned int getMaxK() const	{ return _maxK; }
+	void setMaxK( unsigned int k )	{ _maxK = k; }
+
+	// the nodes that are the clusters after the first k-1 splits, or all of them
+	void cut( unsigned int k, vector<unsigned int> &leaves ) const;
+
+	/* Saves to and loads from a binary file made for a key of the samples and
+	 * the clustering's parameters. load() fails on a file made for another key.
+	 */
+	bool save( const string &path, unsigned long long key ) const;
+	bool load( const string &path, unsigned long long key );
+
+
+  private:
+
+	vector<Node>	_nodes;
+	unsigned int	_maxK;
 
 };
 
@@ -119,25 +189,44 @@ class KMeansClustering
 
 	static KMeansClustering kMeansClusters;
 
+	enum Method
+	{
+		BISECTING,			// bisectingKMeansClustering()
+		BISECTING_REFINED,	// and refine()
+		MINI_BATCH,			// miniBatchKMeansClustering()
+		LLOYD				// lloydKMeansClustering()
+	};
+
+	// how a bisection trial picks its second seed sample
+	enum Seeding
+	{
+		UNIFORM,			// at random
+		KMEANS_PP			// weighted by the squared distance to the first (k-means++)
+	};
+
 	KMeansClustering()
-	:_numClusters(0), _sse(0.0), _sse_set(true)
+	:_numSamples(0), _numClusters(0), _sse(0.0), _sse_set(true), _seed(Param::KMeansSeed), _numBisections(0),
+	 _seeding(UNIFORM), _numRetries(0)
 	{}
 
+	/* The bisection trials draw their seed samples from generators of their own,
+	 * seeded from this, so a clustering can be repeated. 0 takes one from the clock.
+	 */
+	void setSeed( unsigned int seed ) { _seed = seed; }
+	unsigned int getSeed() const { return _seed; }
+
+	void setSeeding( Seeding seeding ) { _seeding = seeding; }
+
+	// bisection passes run again for a half under the minimum size, so far
+	unsigned long getNumRetries() const { return _numRetries; }
+
 	unsigned int getNumSamples();
 	unsigned int getNumClusters() const { return _clusters.size(); }
 
 	void clear();
-	void initClustering( ClusterT &cl );
-
-	void addCluster( ClusterT &cl );
-	void addCluster( ClusterT &cl, Mean &m );
 
-	void addCluster( Cluster &cl )
-	{
-		_clusters.push_back( cl );
-		++_numClusters;
-		_sse_set = false;
-	}
+	// Takes its own copy of the sample views, as one cluster.
+	void initClustering( const ClusterT &cl );
 
 	Cluster *getClusterAt( unsigned int n )
 	{
@@ -158,11 +247,53 @@ class KMeansClustering
 
 
 	void bisectingKMeansClustering( unsigned int k );
+
+	/* Mini-batch k-means (Sculley): k means from random samples, moved by batches
+	 * of samples drawn at random, each sample pulling its nearest mean with a rate
+	 * of 1 / the samples the mean has taken. Stops once no mean moves by more than
+	 * Param::KMeans_MiniBatch_Tolerance of the batch's mean distance, for
+	 * Param::KMeans_MiniBatch_Patience batches in a row. The work does not grow
+	 * with the number of samples; the clusters are left as statistics only.
+	 * Returns the number of batches run.
+	 */
+	unsigned int miniBatchKMeansClustering( unsigned int k, unsigned int batchSize = Param::KMeans_MiniBatch_Size,
+											unsigned int maxBatches = Param::KMeans_MiniBatch_Iterations );
+
+	/* k means seeded by k-means|| (Bahmani et al.) over all the samples: a few
+	 * parallel rounds, each oversampling about 2k samples by their squared
+	 * distance to the seeds so far, then k-means++ over those, weighted by the
+	 * samples nearest each. Then Lloyd iterations by refine().
+	 */
+	void lloydKMeansClustering( unsigned int k );
+
+	// runs one of the methods
+	void cluster( unsigned int k, Method method );
+
+	/* Lloyd iterations over all the clusters together, from where the bisections
+	 * left them, until no sample moves or maxIterations. Hamerly's bounds skip the
+	 * distances that cannot change a sample's cluster. Clusters left empty are
+	 * dropped. Returns the number of iterations run; 0 for clusters without ranges.
+	 */
+	unsigned int refine( unsigned int maxIterations = Param::KMeans_Lloyd_Iterations );
+
 	unsigned int getKMeans( vector< vector<float> > &meansVec );
 
+	// the splits of the bisecting clustering so far
+	const BisectionTree &getTree() const { return _tree; }
+	BisectionTree &getTree() { return _tree; }
+
+	/* A key of the samples and of what the bisections depend on, for the tree
+	 * file; take it before clustering, as a seed of 0 is set from the clock.
+	 */
+	unsigned long long getTreeKey() const;
+
+	// Sets the clusters, as statistics only, to those after the first k-1 splits of the tree.
+	void cutTree( unsigned int k );
+
 
   private:
 
+	ClusterT		_samples;	// reordered as clusters split; the clusters are ranges of it
 	list<Cluster> 	_clusters;
 
 	unsigned long	_numSamples;
@@ -170,13 +301,36 @@ class KMeansClustering
 	double			_sse;
 	bool			_sse_set;
 
+	unsigned int	_seed;
+	unsigned int	_numBisections;
+	Seeding			_seeding;
+	unsigned long	_numRetries;
+
+	BisectionTree			_tree;
+	vector<unsigned int>	_treeNodes;	// of each cluster, in order, while they are the bisections'
+
+	class BisectTrial;
+	class LloydTask;
+	class NearestTask;
+	class CostTask;
+	class OversampleTask;
+
+	void kMeansParallelSeeds( unsigned int k, vector<unsigned long> &seeds );
+
+	// Sets the clusters over the samples grouped by assign[], keeping their order.
+	void regroup( const vector<unsigned int> &assign, unsigned int numClusters );
+
+	// not copyable; the clusters point into the samples
+	KMeansClustering( const KMeansClustering & );
+	KMeansClustering &operator=( const KMeansClustering & );
+
 
   public:
 
 	/* Finds the cluster with the biggest SSE.
-	 * Runs N iterations of bisections.
-	 * Deletes the bisected cluster.
-	 * Adds the best bisection to the end.
+	 * Runs N trial bisections, in parallel.
+	 * Partitions the cluster's samples by the best bisection.
+	 * Replaces the bisected cluster by its two halves, at the end.
 	 * Sets the new SSE of the clustering.
 	 * Returns the new SSE of the clustering.
 	 */
@@ -0,0 +1,284 @@
+/*
+ * ModelSnapshot.cpp
+ *
+ *  Created on: 18 Mar 2014
+ *      Author: jeevw
+ */
+
+#include <sys/mman.h>
+#include <string.h>
+#include <vector>
+
+#include "ModelSnapshot.h"
+#include "WaveletNN.h"
+#include "AlignedArray.h"
+
+
+static const char			ModelMagic[8]		= { 'N', 'T', 'M', 'O', 'D', 'E', 'L', '\0' };
+static const unsigned int	ModelVersion		= 1;
+static const unsigned int	SectionAlignment	= AlignedArray::Alignment;
+
+
+/* Model file layout: this header, then the sections at the given byte offsets,
+ * each aligned to SectionAlignment, so the centres can go to the vector
+ * kernels straight from the mapping. The checksum is of the whole file, with
+ * the checksum itself taken as 0.
+ */
+struct ModelHeader
+{
+	char				magic[8];
+	unsigned int		version;
+	unsigned int		numSections;
+	unsigned int		K;
+	unsigned int		dimension;
+	unsigned int		meanSize;
+	unsigned int		stride;
+	float				radius;
+	float				meanNearest;
+	float				scale;
+	float				r_2;
+	float				cutoff;
+	unsigned int		reserved;
+	unsigned long long	numRows;		// of the Gram matrix; 0 for none
+	unsigned long long	length;			// of the file
+	unsigned long long	offset[ ModelSnapshot::NUM_SECTIONS ];
+	unsigned long long	checksum;
+};
+
+
+static inline size_t align( size_t n )
+{
+	return ( n + SectionAlignment - 1 ) / SectionAlignment * SectionAlignment;
+}
+
+
+// the bytes of each section, for a model of these sizes
+static void sectionLengths( const ModelHeader &h, unsigned long long len[] )
+{
+	unsigned long long K = h.K, gram = ( h.numRows > 0 ) ? K + 1 : 0;
+
+	len[ ModelSnapshot::MEANS ]		= K * h.meanSize * sizeof(float);
+	len[ ModelSnapshot::CENTRES ]	= K * h.stride * sizeof(float);
+	len[ ModelSnapshot::NORMS ]		= K * sizeof(float);
+	len[ ModelSnapshot::WEIGHTS ]	= ( K + 1 ) * sizeof(double);
+	len[ ModelSnapshot::GRAM ]		= gram * gram * sizeof(double);
+	len[ ModelSnapshot::RHS ]		= gram * sizeof(double);
+}
+
+
+static unsigned long long checksum( const void *map, size_t len )
+{
+	ModelHeader h;
+
+	memcpy( &h, map, sizeof(h) );
+	h.checksum = 0;
+	return Util::hashBytes( Util::hashBytes( Util::HashSeed, &h, sizeof(h) ),
+							(const char *)map + sizeof(h), len - sizeof(h) );
+}
+
+
+
+bool ModelSnapshot::write( const string &path, const WaveletNN &nn )
+{
+	const unsigned int K = nn._kMeans.size(), n = Param::InputSampleSize;
+	unsigned long long len[ NUM_SECTIONS ];
+	vector<char> file;
+	ModelHeader h;
+	size_t pos;
+	char *p;
+
+	if ( K == 0  ||  nn._weights.dim() != (int)K + 1  ||  nn._centres.size() == 0 )
+	{
+		Util::log( ERROR, "[ModelSnapshot::write()] The network is not trained." );
+		return false;
+	}
+
+	memset( &h, 0, sizeof(h) );
+	memcpy( h.magic, ModelMagic, sizeof(ModelMagic) );
+	h.version		= ModelVersion;
+	h.numSections	= NUM_SECTIONS;
+	h.K				= K;
+	h.dimension		= n;
+	h.meanSize		= nn._kMeans[0].size();
+	h.stride		= AlignedArray::stride( n );
+	h.radius		= nn._radius;
+	h.meanNearest	= nn._meanNearest;
+	h.scale			= nn._scale;
+	h.r_2			= nn._r_2;
+	h.cutoff		= nn._cutoff;
+	h.numRows		= ( nn._normal.getSize() == K + 1 ) ? nn._normal.getNumRows() : 0;
+
+	sectionLengths( h, len );
+	pos = align( sizeof(h) );
+	for ( unsigned int s = 0; s < NUM_SECTIONS; ++s )
+	{
+		h.offset[s] = pos;
+		pos = align( pos + len[s] );
+	}
+	h.length = pos;
+
+	// the model is small: it is laid out whole, then checksummed and written in one go
+	file.assign( h.length, 0 );
+	p = &file[0];
+	for ( unsigned int j = 0; j < K; ++j )
+	{
+		if ( nn._kMeans[j].size() != h.meanSize )
+		{
+			Util::log( ERROR, "[ModelSnapshot::write()] The means differ in size." );
+			return false;
+		}
+		memcpy( p + h.offset[MEANS] + (size_t)j * h.meanSize * sizeof(float), &nn._kMeans[j][0],
+				h.meanSize * sizeof(float) );
+	}
+	memcpy( p + h.offset[CENTRES], nn._centres.data(), len[CENTRES] );
+	memcpy( p + h.offset[NORMS], &nn._centreNorms[0], len[NORMS] );
+	for ( unsigned int j = 0; j <= K; ++j )
+	{
+		((double *)( p + h.offset[WEIGHTS] ))[j] = nn._weights[j];
+	}
+	if ( h.numRows > 0 )
+	{
+		memcpy( p + h.offset[GRAM], &nn._normal.getGram()[0], len[GRAM] );
+		memcpy( p + h.offset[RHS], &nn._normal.getRhs()[0], len[RHS] );
+	}
+	memcpy( p, &h, sizeof(h) );
+	h.checksum = checksum( p, h.length );
+	memcpy( p, &h, sizeof(h) );
+
+	if ( !Util::writeFile( path, p, h.length, "model file" ) )
+	{
+		return false;
+	}
+
+	Util::log( INFO, string("[ModelSnapshot::write()] Saved a model of K = ") + Util::itoa( K ) + ", "
+					 + Util::itoa( h.length ) + " bytes: " + path );
+	return true;
+}
+
+
+bool ModelSnapshot::map( const string &path )
+{
+	unsigned long long len[ NUM_SECTIONS ];
+	const ModelHeader *h;
+	string why;
+	void *map;
+	size_t mapLen;
+
+	unmap();
+
+	map = Util::mapFile( path, sizeof(ModelHeader), mapLen );
+	if ( !map )
+	{
+		Util::log( ERROR, "[ModelSnapshot::map()] Cannot map model file: " + path );
+		return false;
+	}
+
+	h = (const ModelHeader *)map;
+	if ( !Util::hasTag( h, ModelMagic, ModelVersion )  ||  h->numSections != NUM_SECTIONS )
+	{
+		why = "the wrong magic or version";
+	}
+	else if ( h->dimension == 0  ||  h->stride != AlignedArray::stride( h->dimension )
+			  ||  h->meanSize < h->dimension  ||  h->K < 2 )
+	{
+		why = "bad sizes";
+	}
+	else if ( h->length != mapLen )
+	{
+		why = "the wrong length";
+	}
+	else
+	{
+		sectionLengths( *h, len );
+		if ( !Util::sectionsFit( mapLen, sizeof(ModelHeader), h->offset, len, NUM_SECTIONS, SectionAlignment ) )
+		{
+			why = "a section out of place";
+		}
+		else if ( checksum( map, mapLen ) != h->checksum )
+		{
+			why = "a bad checksum";
+		}
+	}
+	if ( !why.empty() )
+	{
+		Util::log( ERROR, "[ModelSnapshot::map()] Model file with " + why + ": " + path );
+		munmap( map, mapLen );
+		return false;
+	}
+
+	_map = map;
+	_mapLen = mapLen;
+	return true;
+}
+
+
+void ModelSnapshot::unmap()
+{
+	if ( _map )
+	{
+		munmap( _map, _mapLen );
+		_map = NULL;
+		_mapLen = 0;
+	}
+}
+
+
+void ModelSnapshot::restore( WaveletNN &nn ) const
+{
+	const unsigned int K = getK(), m = getMeanSize();
+	const float *means = getMeans();
+	const double *w = getWeights();
+
+	if ( !_map )
+	{
+		throw invalid_argument("[ModelSnapshot::restore()] No model is mapped.");
+	}
+	if ( getDimension() != (unsigned int)Param::InputSampleSize )
+	{
+		throw invalid_argument("[ModelSnapshot::restore()] The model takes a window of " + Util::itoa( getDimension() )
+							   + ", not " + Util::itoa( Param::InputSampleSize ) + ".");
+	}
+
+	nn._kMeans.assign( K, vector<float>() );
+	for ( unsigned int j = 0; j < K; ++j )
+	{
+		nn._kMeans[j].assign( means + (unsigned long)j * m, means + (unsigned long)( j + 1 ) * m );
+	}
+	nn.clearDistances();
+	nn._meanNearest = getMeanNearest();
+	nn._radius = getRadius();
+	nn._cutoff = getCutoff();
+	nn.setCentres();
+
+	nn._weights = leda::vector( K + 1 );
+	for ( unsigned int j = 0; j <= K; ++j )
+	{
+		nn._weights[j] = w[j];
+	}
+	if ( getNumRows() > 0 )
+	{
+		nn._normal.set( K + 1, getNumRows(), getGram(), getRhs() );
+	}
+	else
+	{
+		nn._normal.reset( 0 );
+	}
+}
+
+
+const void *ModelSnapshot::section( Section s ) const
+{
+	return _map ? (const char *)_map + ((const ModelHeader *)_map)->offset[s] : NULL;
+}
+
+
+unsigned int ModelSnapshot::getK() const			{ return _map ? ((const ModelHeader *)_map)->K : 0; }
+unsigned int ModelSnapshot::getDimension() const	{ return _map ? ((const ModelHeader *)_map)->dimension : 0; }
+unsigned int ModelSnapshot::getMeanSize() const		{ return _map ? ((const ModelHeader *)_map)->meanSize : 0; }
+unsigned int ModelSnapshot::getStride() const		{ return _map ? ((const ModelHeader *)_map)->stride : 0; }
+float ModelSnapshot::getRadius() const				{ return _map ? ((const ModelHeader *)_map)->radius : 0; }
+float ModelSnapshot::getMeanNearest() const			{ return _map ? ((const ModelHeader *)_map)->meanNearest : 0; }
+float ModelSnapshot::getScale() const				{ return _map ? ((const ModelHeader *)_map)->scale : 0; }
+float ModelSnapshot::getR2() const					{ return _map ? ((const ModelHeader *)_map)->r_2 : 0; }
+float ModelSnapshot::getCutoff() const				{ return _map ? ((const ModelHeader *)_map)->cutoff : 0; }
+unsigned long ModelSnapshot::getNumRows() const		{ return _map ? ((const ModelHeader *)_map)->numRows : 0; }
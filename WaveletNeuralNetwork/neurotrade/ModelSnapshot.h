@@ -0,0 +1,95 @@
+/*
+ * ModelSnapshot.h
+ *  A trained network on disk: its means, ready aligned, their norms, the
+ *  wavelet constants and the weights, mapped read only so that a process can
+ *  predict without training, and processes share the one copy of its pages.
+ *  Created on: 18 Mar 2014
+ *      Author: jeevw
+ */
+
+#ifndef _NEUROTRADE_MODELSNAPSHOT_H_
+#define _NEUROTRADE_MODELSNAPSHOT_H_
+
+#include <string>
+#include <stddef.h>
+
+#include "def.h"
+
+
+using namespace std;
+
+
+class WaveletNN;
+
+
+class ModelSnapshot
+{
+  public:
+
+	enum Section { MEANS, CENTRES, NORMS, WEIGHTS, GRAM, RHS, NUM_SECTIONS };
+
+	ModelSnapshot() : _map(NULL), _mapLen(0) {}
+	~ModelSnapshot() { unmap(); }
+
+	/* Writes a trained network to path, through a temporary file renamed over
+	 * it, so a process mapping the old model never sees half of the new one.
+	 */
+	static bool write( const string &path, const WaveletNN &nn );
+
+	/* Maps a model file, if it is sound: of this version, every section within
+	 * the file, and its checksum right. Returns false if not. The model may be
+	 * of any window; see getDimension().
+	 */
+	bool map( const string &path );
+	void unmap();
+
+	bool isMapped() const { return _map != NULL; }
+
+	/* Sets the network to the model: its means, radius, cutoff and weights.
+	 * Throws if the model is not of a window of Param::InputSampleSize.
+	 */
+	void restore( WaveletNN &nn ) const;
+
+	unsigned int getK() const;
+	unsigned int getDimension() const;		// of the centres: the window it takes
+	unsigned int getMeanSize() const;		// the means have their target as well
+	unsigned int getStride() const;			// floats from one centre to the next
+
+	float getRadius() const;
+	float getMeanNearest() const;
+	float getScale() const;
+	float getR2() const;
+	float getCutoff() const;
+
+	// K rows of getMeanSize() floats, as the clustering left them
+	const float *getMeans() const			{ return (const float *)section( MEANS ); }
+
+	// K rows of getStride() floats, aligned for the vector kernels, and their squared norms
+	const float *getCentres() const			{ return (const float *)section( CENTRES ); }
+	const float *getCentreNorms() const		{ return (const float *)section( NORMS ); }
+
+	// K + 1, the constant term first
+	const double *getWeights() const		{ return (const double *)section( WEIGHTS ); }
+
+	/* The Gram matrix and right hand side the weights were solved from, for
+	 * online updates; none if getNumRows() is 0.
+	 */
+	const double *getGram() const			{ return (const double *)section( GRAM ); }
+	const double *getRhs() const			{ return (const double *)section( RHS ); }
+	unsigned long getNumRows() const;
+
+
+  private:
+
+	void	*_map;
+	size_t	_mapLen;
+
+	const void *section( Section s ) const;
+
+	// not copyable; predictors may point into the mapping
+	ModelSnapshot( const ModelSnapshot & );
+	ModelSnapshot &operator=( const ModelSnapshot & );
+
+};
+
+#endif /* _NEUROTRADE_MODELSNAPSHOT_H_ */
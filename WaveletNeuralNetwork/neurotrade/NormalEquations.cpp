@@ -0,0 +1,378 @@
+/*
+ * NormalEquations.cpp
+ *
+ *  Created on: 8 Mar 2014
+ *      Author: jeevw
+ */
+
+#include <math.h>
+#include <algorithm>
+#include <stdexcept>
+
+#include "def.h"
+#include "NormalEquations.h"
+
+
+const double NormalEquations::MaxCondition = 1e12;
+
+
+
+void NormalEquations::reset( unsigned int n )
+{
+	_n = n;
+	_numRows = 0;
+	_gram.assign( (unsigned long)n * n, 0.0 );
+	_rhs.assign( n, 0.0 );
+}
+
+
+void NormalEquations::set( unsigned int n, unsigned long numRows, const double *gram, const double *rhs )
+{
+	_n = n;
+	_numRows = numRows;
+	_gram.assign( gram, gram + (unsigned long)n * n );
+	_rhs.assign( rhs, rhs + n );
+}
+
+
+void NormalEquations::addRow( const float *h, double y )
+{
+	double hi, *g;
+
+	for ( unsigned int i = 0; i < _n; ++i )
+	{
+		hi = h[i];
+		_rhs[i] += y * hi;
+		if ( hi == 0 ) continue;
+
+		g = &_gram[ i * _n ];
+		for ( unsigned int j = i; j < _n; ++j )
+		{
+			g[j] += hi * h[j];
+		}
+	}
+	++_numRows;
+}
+
+
+void NormalEquations::addRow( const unsigned int *column, const float *value, unsigned int nnz, double y )
+{
+	double hi, *g;
+
+	for ( unsigned int a = 0; a < nnz; ++a )
+	{
+		hi = value[a];
+		_rhs[ column[a] ] += y * hi;
+
+		g = &_gram[ column[a] * _n ];
+		for ( unsigned int b = a; b < nnz; ++b )
+		{
+			g[ column[b] ] += hi * value[b];
+		}
+	}
+	++_numRows;
+}
+
+
+void NormalEquations::addRows( const float *h, unsigned int ldh, const float *y, unsigned long numRows )
+{
+	for ( unsigned long r = 0; r < numRows; ++r, h += ldh )
+	{
+		addRow( h, y[r] );
+	}
+}
+
+
+void NormalEquations::add( const NormalEquations &e )
+{
+	if ( e._n != _n )
+	{
+		throw invalid_argument( "[NormalEquations::add()] error: sizes differ" );
+	}
+
+	for ( unsigned long i = 0; i < _gram.size(); ++i )
+	{
+		_gram[i] += e._gram[i];
+	}
+	for ( unsigned int i = 0; i < _n; ++i )
+	{
+		_rhs[i] += e._rhs[i];
+	}
+	_numRows += e._numRows;
+}
+
+
+NormalEquations::Method NormalEquations::solve( vector<double> &w ) const
+{
+	if ( _n == 0  ||  _numRows == 0 )
+	{
+		w.assign( _n, 0.0 );
+		return NONE;
+	}
+
+	if ( cholesky( w ) )
+	{
+		return CHOLESKY;
+	}
+
+	Util::log( INFO, "[NormalEquations::solve()] Gram matrix ill-conditioned; solving by pivoted QR." );
+	pivotedQR( w );
+	return PIVOTED_QR;
+}
+
+
+const char *NormalEquations::getMethodName( Method m )
+{
+	static const char *names[] = { "none", "Cholesky", "pivoted QR" };
+	return names[m];
+}
+
+
+
+void NormalEquations::scale( double f )
+{
+	for ( unsigned long i = 0; i < _gram.size(); ++i )
+	{
+		_gram[i] *= f;
+	}
+	for ( unsigned int i = 0; i < _n; ++i )
+	{
+		_rhs[i] *= f;
+	}
+}
+
+
+double NormalEquations::getTrace() const
+{
+	double t = 0;
+
+	for ( unsigned int i = 0; i < _n; ++i )
+	{
+		t += _gram[ i * _n + i ];
+	}
+	return t;
+}
+
+
+bool NormalEquations::invert( vector<double> &inv, double ridge ) const
+{
+	vector<double> L, e( _n ), x;
+
+	if ( _n == 0  ||  !factor( L, ridge ) )
+	{
+		return false;
+	}
+
+	// column by column: G x = e_i
+	inv.assign( (unsigned long)_n * _n, 0.0 );
+	for ( unsigned int i = 0; i < _n; ++i )
+	{
+		e.assign( _n, 0.0 );
+		e[i] = 1;
+		solveFactored( L, e, x );
+		for ( unsigned int j = 0; j < _n; ++j )
+		{
+			inv[ j * _n + i ] = x[j];
+		}
+	}
+	return true;
+}
+
+
+
+bool NormalEquations::cholesky( vector<double> &w ) const
+{
+	vector<double> L;
+
+	if ( !factor( L, 0 ) )
+	{
+		return false;
+	}
+	solveFactored( L, _rhs, w );
+	return true;
+}
+
+
+bool NormalEquations::factor( vector<double> &L, double ridge ) const
+{
+	double s, d, minD = HUGE_VAL, maxD = 0;
+	unsigned int i, j, k;
+
+	// G + ridge I = L L'
+	L.assign( (unsigned long)_n * _n, 0.0 );
+	for ( j = 0; j < _n; ++j )
+	{
+		s = gram( j, j ) + ridge;
+		for ( k = 0; k < j; ++k )
+		{
+			s -= L[ j * _n + k ] * L[ j * _n + k ];
+		}
+		if ( !( s > 0 ) )
+		{
+			return false;		// not positive definite, to working precision
+		}
+		d = sqrt( s );
+		L[ j * _n + j ] = d;
+		minD = min( minD, d );
+		maxD = max( maxD, d );
+
+		for ( i = j + 1; i < _n; ++i )
+		{
+			s = gram( i, j );
+			for ( k = 0; k < j; ++k )
+			{
+				s -= L[ i * _n + k ] * L[ j * _n + k ];
+			}
+			L[ i * _n + j ] = s / d;
+		}
+	}
+
+	// the ratio of the diagonal of L bounds the condition number of G from below
+	return ( maxD / minD ) * ( maxD / minD ) <= MaxCondition;
+}
+
+
+void NormalEquations::solveFactored( const vector<double> &L, const vector<double> &b, vector<double> &w ) const
+{
+	double s;
+	unsigned int i, k;
+
+	// L z = b, then L' w = z
+	w.assign( _n, 0.0 );
+	for ( i = 0; i < _n; ++i )
+	{
+		s = b[i];
+		for ( k = 0; k < i; ++k )
+		{
+			s -= L[ i * _n + k ] * w[k];
+		}
+		w[i] = s / L[ i * _n + i ];
+	}
+	for ( i = _n; i-- > 0; )
+	{
+		s = w[i];
+		for ( k = i + 1; k < _n; ++k )
+		{
+			s -= L[ k * _n + i ] * w[k];
+		}
+		w[i] = s / L[ i * _n + i ];
+	}
+}
+
+
+void NormalEquations::pivotedQR( vector<double> &w ) const
+{
+	vector<double> A( (unsigned long)_n * _n ), c( _rhs ), z;
+	vector<unsigned int> perm( _n );
+	double norm, best, alpha, vv, s;
+	unsigned int i, j, k, p, rank;
+
+	for ( i = 0; i < _n; ++i )
+	{
+		for ( j = 0; j < _n; ++j )
+		{
+			A[ i * _n + j ] = gram( i, j );
+		}
+		perm[i] = i;
+	}
+
+	// Householder QR, bringing the largest remaining column forward at each step
+	for ( k = 0; k < _n; ++k )
+	{
+		best = -1;
+		p = k;
+		for ( j = k; j < _n; ++j )
+		{
+			norm = 0;
+			for ( i = k; i < _n; ++i )
+			{
+				norm += A[ i * _n + j ] * A[ i * _n + j ];
+			}
+			if ( norm > best )
+			{
+				best = norm;
+				p = j;
+			}
+		}
+		if ( p != k )
+		{
+			for ( i = 0; i < _n; ++i )
+			{
+				swap( A[ i * _n + k ], A[ i * _n + p ] );
+			}
+			swap( perm[k], perm[p] );
+		}
+
+		alpha = sqrt( best );
+		if ( alpha == 0 )
+		{
+			break;
+		}
+		if ( A[ k * _n + k ] > 0 )
+		{
+			alpha = -alpha;
+		}
+
+		// v = a - alpha e1, kept in column k below the diagonal and on it
+		A[ k * _n + k ] -= alpha;
+		vv = 0;
+		for ( i = k; i < _n; ++i )
+		{
+			vv += A[ i * _n + k ] * A[ i * _n + k ];
+		}
+
+		for ( j = k + 1; j < _n; ++j )
+		{
+			s = 0;
+			for ( i = k; i < _n; ++i )
+			{
+				s += A[ i * _n + k ] * A[ i * _n + j ];
+			}
+			s = 2 * s / vv;
+			for ( i = k; i < _n; ++i )
+			{
+				A[ i * _n + j ] -= s * A[ i * _n + k ];
+			}
+		}
+
+		s = 0;
+		for ( i = k; i < _n; ++i )
+		{
+			s += A[ i * _n + k ] * c[i];
+		}
+		s = 2 * s / vv;
+		for ( i = k; i < _n; ++i )
+		{
+			c[i] -= s * A[ i * _n + k ];
+		}
+
+		A[ k * _n + k ] = alpha;	// R(k,k)
+	}
+
+	// the numerical rank: the diagonal of R does not grow
+	for ( rank = 0; rank < _n  &&  rank < k; ++rank )
+	{
+		if ( fabs( A[ rank * _n + rank ] ) * MaxCondition <= fabs( A[0] ) ) break;
+	}
+
+	// R z = Q'b over the leading rank columns; the rest of the weights stay zero
+	z.assign( rank, 0.0 );
+	for ( i = rank; i-- > 0; )
+	{
+		s = c[i];
+		for ( j = i + 1; j < rank; ++j )
+		{
+			s -= A[ i * _n + j ] * z[j];
+		}
+		z[i] = s / A[ i * _n + i ];
+	}
+
+	w.assign( _n, 0.0 );
+	for ( i = 0; i < rank; ++i )
+	{
+		w[ perm[i] ] = z[i];
+	}
+
+	Util::log( INFO, string("[NormalEquations::pivotedQR()] Rank ") + Util::itoa( rank )
+					 + " of " + Util::itoa( _n ) + "." );
+}
@@ -0,0 +1,90 @@
+/*
+ * NormalEquations.h
+ *  Least squares by the normal equations, gathered a row at a time:
+ *  only the n x n Gram matrix and the right hand side are kept.
+ *  Created on: 8 Mar 2014
+ *      Author: jeevw
+ */
+
+#ifndef _NEUROTRADE_NORMALEQUATIONS_H_
+#define _NEUROTRADE_NORMALEQUATIONS_H_
+
+#include <vector>
+
+
+using namespace std;
+
+
+class NormalEquations
+{
+  public:
+
+	enum Method { NONE, CHOLESKY, PIVOTED_QR };
+
+	// Cholesky is trusted up to this estimate of the Gram matrix's condition number.
+	static const double MaxCondition;
+
+	NormalEquations( unsigned int n = 0 ) { reset( n ); }
+
+	void reset( unsigned int n );
+
+	// G += h h', b += y h, for a row h of n terms
+	void addRow( const float *h, double y );
+
+	// A sparse row: nnz terms h[c] = value[c] at columns column[c], in increasing order.
+	void addRow( const unsigned int *column, const float *value, unsigned int nnz, double y );
+
+	// numRows rows, ldh floats apart, with their targets
+	void addRows( const float *h, unsigned int ldh, const float *y, unsigned long numRows );
+
+	// Adds the rows gathered by another of the same size.
+	void add( const NormalEquations &e );
+
+	// G *= f, b *= f; to forget the rows so far by f
+	void scale( double f );
+
+	/* Solves G w = b. By Cholesky if G is positive definite and well conditioned,
+	 * otherwise by QR with column pivoting, which leaves the weights of the
+	 * columns it finds dependent at zero. Returns the method used, or NONE if
+	 * there is nothing to solve.
+	 */
+	Method solve( vector<double> &w ) const;
+
+	/* The inverse of G + ridge I, n x n, by Cholesky; false if that is not
+	 * positive definite or is beyond MaxCondition.
+	 */
+	bool invert( vector<double> &inv, double ridge = 0 ) const;
+
+	double getTrace() const;
+
+	unsigned int getSize() const		{ return _n; }
+	unsigned long getNumRows() const	{ return _numRows; }
+
+	// G, n x n with only its upper triangle set, and b; to save them
+	const vector<double> &getGram() const	{ return _gram; }
+	const vector<double> &getRhs() const	{ return _rhs; }
+
+	// Takes G and b as saved from one of size n, over numRows rows.
+	void set( unsigned int n, unsigned long numRows, const double *gram, const double *rhs );
+
+	static const char *getMethodName( Method m );
+
+
+  private:
+
+	unsigned int	_n;
+	unsigned long	_numRows;
+	vector<double>	_gram;		// n x n, upper triangle only
+	vector<double>	_rhs;
+
+	double gram( unsigned int i, unsigned int j ) const
+		{ return ( i <= j ) ? _gram[ i * _n + j ] : _gram[ j * _n + i ]; }
+
+	bool cholesky( vector<double> &w ) const;
+	bool factor( vector<double> &L, double ridge ) const;
+	void solveFactored( const vector<double> &L, const vector<double> &b, vector<double> &w ) const;
+	void pivotedQR( vector<double> &w ) const;
+
+};
+
+#endif /* _NEUROTRADE_NORMALEQUATIONS_H_ */
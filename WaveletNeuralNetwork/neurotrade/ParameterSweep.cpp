@@ -0,0 +1,311 @@
+/*
+ * ParameterSweep.cpp
+ *
+ *  Created on: 20 Mar 2014
+ *      Author: jeevw
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <stdexcept>
+
+#include "ParameterSweep.h"
+#include "ThreadPool.h"
+
+
+
+// configs of a K and window together, the RFactors in order
+static bool byGroup( const ParameterSweep::Result &a, const ParameterSweep::Result &b )
+{
+	if ( a.config.window != b.config.window )	return a.config.window < b.config.window;
+	if ( a.config.k != b.config.k )				return a.config.k < b.config.k;
+	return a.config.rFactor < b.config.rFactor;
+}
+
+
+// best directional accuracy first, those that did not run last
+static bool byAccuracy( const ParameterSweep::Result &a, const ParameterSweep::Result &b )
+{
+	if ( a.failure.empty() != b.failure.empty() )	return a.failure.empty();
+	return a.error.directional_err < b.error.directional_err;
+}
+
+
+
+ParameterSweep::ParameterSweep( SampleStore &store, KMeansClustering::Method method,
+								KMeansClustering::Seeding seeding, float cutoff )
+	: _store( store ), _method( method ), _seeding( seeding ), _cutoff( cutoff ), _treeKey( 0 )
+{}
+
+
+void ParameterSweep::addGrid( const vector<unsigned int> &ks, const vector<float> &rFactors,
+							  const vector<unsigned int> &windows )
+{
+	vector<unsigned int> w( windows.empty() ? vector<unsigned int>( 1, Param::InputSampleSize ) : windows );
+	Config c;
+
+	for ( unsigned int i = 0; i < w.size(); ++i )
+	{
+		for ( unsigned int j = 0; j < ks.size(); ++j )
+		{
+			for ( unsigned int f = 0; f < rFactors.size(); ++f )
+			{
+				c.window = w[i];
+				c.k = ks[j];
+				c.rFactor = rFactors[f];
+				_configs.push_back( c );
+			}
+		}
+	}
+}
+
+
+void ParameterSweep::addRandom( unsigned int n, unsigned int kMin, unsigned int kMax, float rfMin, float rfMax,
+								const vector<unsigned int> &windows, unsigned int seed )
+{
+	vector<unsigned int> w( windows.empty() ? vector<unsigned int>( 1, Param::InputSampleSize ) : windows );
+	unsigned int state = seed;
+	Config c;
+
+	if ( kMax < kMin )
+	{
+		swap( kMin, kMax );
+	}
+	for ( unsigned int i = 0; i < n; ++i )
+	{
+		c.k = kMin + rand_r( &state ) % ( kMax - kMin + 1 );
+		c.rFactor = rfMin + ( rfMax - rfMin ) * ( rand_r( &state ) / ( RAND_MAX + 1.0 ) );
+		c.window = w[ rand_r( &state ) % w.size() ];
+		_configs.push_back( c );
+	}
+}
+
+
+void ParameterSweep::runGroup( unsigned int begin, unsigned int end )
+{
+	const Config &first = _results[begin].config;
+	WaveletNN nn;
+	double t0, clusterTime, distanceTime;
+	unsigned int i = begin;
+
+	try
+	{
+		// the samples are views of the store, and the means are cut from the shared tree
+		nn.setSamples( _store );
+		nn.setCutoff( _cutoff );
+		if ( _tree.getMaxK() >= first.k )
+		{
+			nn.setClusterTree( _tree, _treeKey );
+		}
+
+		t0 = Util::getTime();
+		nn.setWaveletMeansAndRadius( first.k, first.rFactor, _method, _seeding );
+		clusterTime = Util::getTime() - t0;
+
+		t0 = Util::getTime();
+		nn.cacheDistances();
+		distanceTime = Util::getTime() - t0;
+
+		for ( ; i < end; ++i )
+		{
+			Result &r = _results[i];
+
+			r.clusterTime = clusterTime;
+			r.distanceTime = distanceTime;
+
+			t0 = Util::getTime();
+			nn.setRadiusFactor( r.config.rFactor );
+			nn.trainWeights();
+			r.trainTime = Util::getTime() - t0;
+
+			t0 = Util::getTime();
+			r.error = nn.test();
+			r.testTime = Util::getTime() - t0;
+		}
+	}
+	catch ( exception &e )
+	{
+		for ( ; i < end; ++i )
+		{
+			_results[i].failure = e.what();
+		}
+	}
+}
+
+
+// The configs of one K and window, in one thread; the network's own parallel stages run inline.
+class ParameterSweep::GroupTask: public ThreadTask
+{
+  public:
+
+	GroupTask( ParameterSweep &sweep, unsigned int begin, unsigned int end )
+		: _sweep(sweep), _begin(begin), _end(end)
+	{}
+
+	void run() { _sweep.runGroup( _begin, _end ); }
+
+
+  private:
+
+	ParameterSweep	&_sweep;
+	unsigned int	_begin, _end;
+
+};
+
+
+// Grows the bisection tree of the store's windows to K, to cut the smaller Ks of the window from.
+void ParameterSweep::growTree( unsigned int maxK, bool useTreePath )
+{
+	WaveletNN nn;
+
+	_tree.clear();
+	nn.setSamples( _store );
+	if ( useTreePath )
+	{
+		nn.setClusterTreePath( _treePath );
+	}
+	try
+	{
+		nn.setWaveletMeansAndRadius( maxK, Param::Radius_Factor, _method, _seeding );
+		_tree = nn.getClusterTree();
+		_treeKey = nn.getClusterTreeKey();
+	}
+	catch ( exception &e )
+	{
+		// each K then clusters for itself
+		Util::log( ERROR, string("[ParameterSweep::growTree()] Cannot grow the bisection tree: ") + e.what() );
+	}
+}
+
+
+const vector<ParameterSweep::Result> &ParameterSweep::run()
+{
+	const int window = Param::InputSampleSize;
+	const unsigned int windowLength = _store.getWindowLength();
+	vector<GroupTask> groupTasks;
+	vector<ThreadTask *> tasks;
+	unsigned int i, j, w, end, maxK, numGroups = 0;
+	double t0 = Util::getTime(), treeTime = 0;
+	Result r;
+
+	_results.clear();
+	r.clusterTime = r.distanceTime = r.trainTime = r.testTime = 0;
+	r.error.directional_err = r.error.mean_sqr_err = r.error.mean_fractional_error = 0;
+	for ( i = 0; i < _configs.size(); ++i )
+	{
+		r.config = _configs[i];
+		r.failure.clear();
+		if ( r.config.window < 1 )
+		{
+			r.failure = "a window takes 1 return or more";
+		}
+		else if ( r.config.k < 2 )
+		{
+			r.failure = "K must be 2 or more";
+		}
+		_results.push_back( r );
+	}
+	sort( _results.begin(), _results.end(), byGroup );
+
+	/* A window at a time, as the network takes its window from the settings:
+	 * its samples are views of that length, and its groups then run together.
+	 */
+	for ( w = 0; w < _results.size(); w = end )
+	{
+		maxK = 0;
+		for ( end = w; end < _results.size()  &&  _results[end].config.window == _results[w].config.window; ++end )
+		{
+			if ( _results[end].failure.empty() )
+			{
+				maxK = max( maxK, _results[end].config.k );
+			}
+		}
+		if ( maxK == 0 )
+		{
+			continue;
+		}
+		Param::InputSampleSize = _results[w].config.window;
+		_store.setWindowLength( Param::InputSampleSize + Param::NumPredBars );
+
+		// bisect once, to the largest K of the window, and share the tree; the kept tree is of the program's window only
+		_tree.clear();
+		if ( _method == KMeansClustering::BISECTING )
+		{
+			double t1 = Util::getTime();
+
+			growTree( maxK, Param::InputSampleSize == window );
+			treeTime += Util::getTime() - t1;
+		}
+
+		groupTasks.clear();
+		tasks.clear();
+		for ( i = w; i < end; i = j )
+		{
+			for ( j = i + 1; j < end  &&  _results[j].config.k == _results[i].config.k; ++j );
+			if ( _results[i].failure.empty() )
+			{
+				groupTasks.push_back( GroupTask( *this, i, j ) );
+			}
+		}
+		for ( i = 0; i < groupTasks.size(); ++i )
+		{
+			tasks.push_back( &groupTasks[i] );
+		}
+		ThreadPool::getDefault().run( tasks );
+		numGroups += groupTasks.size();
+	}
+	Param::InputSampleSize = window;
+	_store.setWindowLength( windowLength );
+	_tree.clear();
+
+	stable_sort( _results.begin(), _results.end(), byAccuracy );
+
+	Util::log( INFO, string("[ParameterSweep::run()] ") + Util::itoa( _results.size() ) + " configs in "
+					 + Util::itoa( numGroups ) + " groups of a K and window, on "
+					 + Util::itoa( ThreadPool::getDefault().getNumThreads() ) + " threads, in "
+					 + Util::ftoa( Util::getTime() - t0 ) + " s"
+					 + ( _method == KMeansClustering::BISECTING ? ", " + Util::ftoa( treeTime )
+							 + " s of it growing the bisection trees." : string(".") ) );
+	if ( !_results.empty()  &&  _results[0].failure.empty() )
+	{
+		Util::log( INFO, string("[ParameterSweep::run()] Best: K = ") + Util::itoa( _results[0].config.k )
+						 + ", RFactor " + Util::ftoa( _results[0].config.rFactor ) + ", window "
+						 + Util::itoa( _results[0].config.window ) + ", with directional accuracy "
+						 + Util::ftoa( 100 - _results[0].error.directional_err ) + "%." );
+	}
+
+	return _results;
+}
+
+
+bool ParameterSweep::writeTable( const string &path ) const
+{
+	FILE *f = fopen( path.c_str(), "w" );
+	bool ok;
+
+	if ( !f )
+	{
+		Util::log( ERROR, "[ParameterSweep::writeTable()] Cannot write the results table: " + path );
+		return false;
+	}
+
+	ok = fprintf( f, "rank\tK\tRFactor\twindow\taccuracy_pct\tcluster_s\tdistances_s\ttrain_s\ttest_s\tfailure\n" ) > 0;
+	for ( unsigned int i = 0; i < _results.size()  &&  ok; ++i )
+	{
+		const Result &r = _results[i];
+
+		ok = fprintf( f, "%u\t%u\t%g\t%u\t%.4f\t%.6f\t%.6f\t%.6f\t%.6f\t%s\n", i + 1, r.config.k, r.config.rFactor,
+					  r.config.window, r.failure.empty() ? 100 - r.error.directional_err : 0.0, r.clusterTime,
+					  r.distanceTime, r.trainTime, r.testTime, r.failure.c_str() ) > 0;
+	}
+	ok = ( fclose( f ) == 0 ) && ok;
+	if ( !ok )
+	{
+		Util::log( ERROR, "[ParameterSweep::writeTable()] Failed writing the results table: " + path );
+		return false;
+	}
+
+	Util::log( INFO, "[ParameterSweep::writeTable()] Results table written: " + path );
+	return true;
+}
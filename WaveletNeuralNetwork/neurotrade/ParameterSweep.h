@@ -0,0 +1,109 @@
+/*
+ * ParameterSweep.h
+ *  Trains and tests the network for many settings in one process, over the
+ *  one loaded series, and ranks them by directional accuracy.
+ *  Created on: 20 Mar 2014
+ *      Author: jeevw
+ */
+
+#ifndef _NEUROTRADE_PARAMETERSWEEP_H_
+#define _NEUROTRADE_PARAMETERSWEEP_H_
+
+#include <string>
+#include <vector>
+
+#include "def.h"
+#include "SampleStore.h"
+#include "KMeansClustering.h"
+#include "WaveletNN.h"
+
+
+using namespace std;
+
+
+class ParameterSweep
+{
+  public:
+
+	struct Config
+	{
+		unsigned int	k;
+		float			rFactor;
+		unsigned int	window;		// the returns a sample takes in
+	};
+
+	/* A config's times in s. The means and the distances to them are shared by
+	 * the configs of the same K and window, so those times are of the group.
+	 */
+	struct Result
+	{
+		Config				config;
+		double				clusterTime;	// to set the means, from the shared tree if bisecting
+		double				distanceTime;	// to cache the distances of the samples to the means
+		double				trainTime;
+		double				testTime;
+		WaveletNN::Error	error;
+		string				failure;		// why it did not run; empty if it did
+	};
+
+	/* The store must outlive the sweep. It takes the windows of each config in
+	 * turn, and is left as it was.
+	 */
+	ParameterSweep( SampleStore &store, KMeansClustering::Method method = KMeansClustering::BISECTING,
+					KMeansClustering::Seeding seeding = KMeansClustering::UNIFORM,
+					float cutoff = Param::Wavelet_Cutoff );
+
+	// Where the network keeps its tree of bisections, as WaveletNN::setClusterTreePath().
+	void setClusterTreePath( const string &path ) { _treePath = path; }
+
+	void addConfig( const Config &c ) { _configs.push_back( c ); }
+
+	// Every combination of the values; no windows for that of Param::InputSampleSize only.
+	void addGrid( const vector<unsigned int> &ks, const vector<float> &rFactors,
+				  const vector<unsigned int> &windows = vector<unsigned int>() );
+
+	/* n configs drawn at random, K in [kMin, kMax] and RFactor in [rfMin, rfMax],
+	 * and a window from those given; from the seed, so a draw can be repeated.
+	 */
+	void addRandom( unsigned int n, unsigned int kMin, unsigned int kMax, float rfMin, float rfMax,
+					const vector<unsigned int> &windows = vector<unsigned int>(), unsigned int seed = 1 );
+
+	unsigned int getNumConfigs() const { return _configs.size(); }
+
+	/* Runs the configs, best directional accuracy first, a window at a time,
+	 * with Param::InputSampleSize set to it meanwhile. If bisecting, the
+	 * clustering of a window runs once, to its largest K, and each of its Ks is
+	 * cut from that tree. The configs of a K and window are then a task on the
+	 * default pool: they set the means and cache the distances once, and train
+	 * and test for each RFactor from those.
+	 */
+	const vector<Result> &run();
+
+	// Writes the results as a table of tab separated columns, with a header line.
+	bool writeTable( const string &path ) const;
+
+
+  private:
+
+	SampleStore					&_store;
+	KMeansClustering::Method	_method;
+	KMeansClustering::Seeding	_seeding;
+	float						_cutoff;
+
+	vector<Config>	_configs;
+	vector<Result>	_results;
+
+	string				_treePath;
+	BisectionTree		_tree;		// of the training samples of the window running, to its largest K
+	unsigned long long	_treeKey;
+
+	class GroupTask;
+
+	void growTree( unsigned int maxK, bool useTreePath );
+
+	// the configs of indices [begin, end) of the results, of one K and window
+	void runGroup( unsigned int begin, unsigned int end );
+
+};
+
+#endif /* _NEUROTRADE_PARAMETERSWEEP_H_ */
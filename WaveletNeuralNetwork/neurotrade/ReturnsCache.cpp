@@ -0,0 +1,379 @@
+/*
+ * ReturnsCache.cpp
+ *
+ *  Created on: 26 Feb 2014
+ *      Author: jeevw
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "ReturnsCache.h"
+#include "ThreadPool.h"
+
+
+static const char			CacheMagic[8]	= { 'N', 'T', 'R', 'B', 'A', 'R', 'S', '\0' };
+static const unsigned int	CacheVersion	= 3;	// of the layout and of the merge of the files
+static const unsigned int	ColumnAlignment = 64;
+
+
+/* Cache file layout: this header, then the columns at the given byte offsets,
+ * each aligned to ColumnAlignment. A file cache of one data file has no returns.
+ */
+struct CacheHeader
+{
+	char				magic[8];
+	unsigned int		version;
+	unsigned int		numColumns;
+	unsigned long long	key;			// of the data file(s) it was built from
+	unsigned long long	numBars;
+	unsigned long long	numReturns;
+	unsigned long long	offset[ ReturnsCache::NUM_COLUMNS ];
+};
+
+static const size_t ColumnWidth[ ReturnsCache::NUM_COLUMNS ] =
+{
+	sizeof(unsigned long long), sizeof(float), sizeof(float), sizeof(float), sizeof(float),
+	sizeof(unsigned int), sizeof(unsigned int), sizeof(float)
+};
+
+
+static inline size_t align( size_t n )
+{
+	return ( n + ColumnAlignment - 1 ) / ColumnAlignment * ColumnAlignment;
+}
+
+
+
+long ReturnsCache::load( SampleStore &store )
+{
+	vector<string> files;
+	vector<unsigned long long> keys;
+	unsigned long long seriesKey = Util::hashBytes( Util::HashSeed, &CacheVersion, sizeof(CacheVersion) );
+	string seriesPath = _cacheDir + "/series.cache";
+	double t0 = Util::getTime();
+	struct stat st;
+
+	unmap();
+	if ( !BarLoader::listDir( _dataDir, files ) )
+	{
+		return -1;
+	}
+
+	// A data file is known by its name, size and modification time.
+	for ( unsigned int i = 0; i < files.size(); ++i )
+	{
+		unsigned long long key = Util::HashSeed;
+
+		if ( stat( (_dataDir + "/" + files[i]).c_str(), &st ) != 0 )
+		{
+			Util::log( ERROR, "[ReturnsCache::load()] Cannot stat bar data file: " + files[i] );
+			return -1;
+		}
+		key = Util::hashBytes( key, &st.st_size, sizeof(st.st_size) );
+		key = Util::hashBytes( key, &st.st_mtim, sizeof(st.st_mtim) );
+		keys.push_back( key );
+
+		seriesKey = Util::hashBytes( seriesKey, files[i].c_str(), files[i].size() + 1 );
+		seriesKey = Util::hashBytes( seriesKey, &key, sizeof(key) );
+	}
+
+	_map = mapFile( seriesPath, seriesKey, _mapLen );
+	if ( _map )
+	{
+		Util::log( INFO, "[ReturnsCache::load()] Returns cache is up to date." );
+	}
+	else
+	{
+		Util::log( INFO, "[ReturnsCache::load()] Rebuilding the returns cache in: " + _cacheDir );
+		if ( !rebuild( files, keys, seriesKey ) )
+		{
+			return -1;
+		}
+		_map = mapFile( seriesPath, seriesKey, _mapLen );
+		if ( !_map )
+		{
+			Util::log( ERROR, "[ReturnsCache::load()] Cannot map the rebuilt returns cache: " + seriesPath );
+			return -1;
+		}
+	}
+
+	store.attach( getReturns(), ((const CacheHeader *)_map)->numReturns );
+
+	Util::log( INFO, string("[ReturnsCache::load()] Mapped ") + Util::itoa( getNumBars() ) + " bars and "
+					 + Util::itoa( store.getNumReturns() ) + " returns in "
+					 + Util::ftoa( Util::getTime() - t0 ) + "s." );
+
+	return store.getNumReturns();
+}
+
+
+// Brings the bars of one data file in, from its own cache if that is up to date.
+class ReturnsCache::FileTask: public ThreadTask
+{
+  public:
+
+	FileTask( const string &dataPath, const string &cachePath, unsigned long long key, vector<Bar> &bars )
+		: _dataPath(dataPath), _cachePath(cachePath), _key(key), _bars(bars), _n(0), _parsed(false)
+	{}
+
+	void run()
+	{
+		size_t len;
+		void *map = mapFile( _cachePath, _key, len );
+
+		if ( map )
+		{
+			readBars( map, _bars );
+			munmap( map, len );
+			_n = _bars.size();
+			return;
+		}
+
+		_n = BarLoader::parseFile( _dataPath, _bars );
+		_parsed = true;
+		if ( _n >= 0 )
+		{
+			writeFile( _cachePath, _key, _bars, NULL, 0 );
+		}
+	}
+
+	long getNumBars() const	{ return _n; }
+	bool wasParsed() const	{ return _parsed; }
+
+  private:
+
+	string				_dataPath;
+	string				_cachePath;
+	unsigned long long	_key;
+	vector<Bar>			&_bars;
+	long				_n;
+	bool				_parsed;
+
+};
+
+
+bool ReturnsCache::rebuild( const vector<string> &files, const vector<unsigned long long> &keys,
+							unsigned long long seriesKey )
+{
+	BarLoader loader;
+	SampleStore returns;
+	vector< vector<Bar> > fileBars( files.size() );
+	vector<FileTask> fileTasks;
+	vector<ThreadTask *> tasks;
+	bool failed = false;
+
+	if ( mkdir( _cacheDir.c_str(), 0755 ) != 0  &&  errno != EEXIST )
+	{
+		Util::log( ERROR, "[ReturnsCache::rebuild()] Cannot create the cache directory: " + _cacheDir );
+		return false;
+	}
+
+	fileTasks.reserve( files.size() );
+	for ( unsigned int i = 0; i < files.size(); ++i )
+	{
+		fileTasks.push_back( FileTask( _dataDir + "/" + files[i], _cacheDir + "/" + files[i] + ".bars",
+									   keys[i], fileBars[i] ) );
+	}
+	for ( unsigned int i = 0; i < files.size(); ++i )
+	{
+		tasks.push_back( &fileTasks[i] );
+	}
+	ThreadPool::getDefault().run( tasks );
+
+	for ( unsigned int i = 0; i < files.size(); ++i )
+	{
+		if ( fileTasks[i].getNumBars() < 0 )
+		{
+			Util::log( ERROR, "[ReturnsCache::rebuild()] Failed to load NeuroTrade data in: " + files[i] );
+			failed = true;
+		}
+		else if ( fileTasks[i].wasParsed() )
+		{
+			Util::log( SUCCESS, string("[ReturnsCache::rebuild()] Parsed ") + Util::itoa( fileTasks[i].getNumBars() )
+								+ " bars in: " + files[i] );
+		}
+	}
+
+	// a series without one of the files must not be cached as up to date with it
+	if ( failed )
+	{
+		return false;
+	}
+
+	loader.merge( fileBars );
+	loader.calcReturns( returns );
+
+	return writeFile( _cacheDir + "/series.cache", seriesKey,
+					  loader.getBars(), returns.data(), returns.getNumReturns() );
+}
+
+
+void *ReturnsCache::mapFile( const string &path, unsigned long long key, size_t &len )
+{
+	unsigned long long length[ NUM_COLUMNS ];
+	const CacheHeader *h;
+	void *map;
+
+	map = Util::mapFile( path, sizeof(CacheHeader), len );
+	if ( !map )
+	{
+		return NULL;
+	}
+
+	h = (const CacheHeader *)map;
+	if ( !Util::hasTag( h, CacheMagic, CacheVersion )  ||  h->numColumns != NUM_COLUMNS  ||  h->key != key )
+	{
+		munmap( map, len );
+		return NULL;
+	}
+	for ( unsigned int c = 0; c < NUM_COLUMNS; ++c )
+	{
+		length[c] = ( ( c == RETURNS ) ? h->numReturns : h->numBars ) * ColumnWidth[c];
+	}
+	if ( !Util::sectionsFit( len, sizeof(CacheHeader), h->offset, length, NUM_COLUMNS, ColumnAlignment ) )
+	{
+		Util::log( ERROR, "[ReturnsCache::mapFile()] Truncated cache file: " + path );
+		munmap( map, len );
+		return NULL;
+	}
+
+	return map;
+}
+
+
+// The header, then each column of the bars, or the returns, at its offset.
+class CacheWriter: public Util::FileWriter
+{
+  public:
+
+	CacheWriter( const CacheHeader &h, const vector<Bar> &bars, const float *returns )
+		: _h(h), _bars(bars), _returns(returns)
+	{}
+
+	bool write( FILE *f )
+	{
+		static const char zeros[ ColumnAlignment ] = { 0 };
+		const unsigned long n = _bars.size(), numReturns = _h.numReturns;
+		size_t pos = sizeof(_h);
+		bool ok;
+
+		ok = fwrite( &_h, sizeof(_h), 1, f ) == 1;
+		for ( unsigned int c = 0; c < ReturnsCache::NUM_COLUMNS  &&  ok; ++c )
+		{
+			ok = ok && fwrite( zeros, 1, _h.offset[c] - pos, f ) == _h.offset[c] - pos;
+			pos = _h.offset[c];
+
+			if ( c == ReturnsCache::RETURNS )
+			{
+				ok = ok && ( numReturns == 0  ||  fwrite( _returns, sizeof(float), numReturns, f ) == numReturns );
+				pos += numReturns * sizeof(float);
+				continue;
+			}
+			for ( unsigned long i = 0; i < n  &&  ok; ++i )
+			{
+				const Bar &b = _bars[i];
+				unsigned long long ts = b.getTimestamp();
+				const void *v;
+
+				switch ( c )
+				{
+				  case ReturnsCache::TIMESTAMP:	v = &ts;			break;
+				  case ReturnsCache::OPEN:		v = &b.open;		break;
+				  case ReturnsCache::HIGH:		v = &b.high;		break;
+				  case ReturnsCache::LOW:		v = &b.low;			break;
+				  case ReturnsCache::CLOSE:		v = &b.close;		break;
+				  case ReturnsCache::UPTICKS:	v = &b.upticks;		break;
+				  default:						v = &b.downticks;	break;
+				}
+				ok = fwrite( v, ColumnWidth[c], 1, f ) == 1;
+			}
+			pos += n * ColumnWidth[c];
+		}
+		return ok;
+	}
+
+
+  private:
+
+	const CacheHeader	&_h;
+	const vector<Bar>	&_bars;
+	const float			*_returns;
+
+};
+
+
+bool ReturnsCache::writeFile( const string &path, unsigned long long key,
+							  const vector<Bar> &bars, const float *returns, unsigned long numReturns )
+{
+	CacheHeader h;
+	size_t pos;
+	unsigned long n = bars.size();
+
+	memset( &h, 0, sizeof(h) );
+	memcpy( h.magic, CacheMagic, sizeof(CacheMagic) );
+	h.version		= CacheVersion;
+	h.numColumns	= NUM_COLUMNS;
+	h.key			= key;
+	h.numBars		= n;
+	h.numReturns	= numReturns;
+
+	pos = align( sizeof(h) );
+	for ( unsigned int c = 0; c < NUM_COLUMNS; ++c )
+	{
+		h.offset[c] = pos;
+		pos = align( pos + ColumnWidth[c] * ( ( c == RETURNS ) ? numReturns : n ) );
+	}
+
+	CacheWriter writer( h, bars, returns );
+	return Util::writeFile( path, writer, "cache file" );
+}
+
+
+void ReturnsCache::readBars( const void *map, vector<Bar> &bars )
+{
+	const CacheHeader *h = (const CacheHeader *)map;
+	const char *base = (const char *)map;
+	const unsigned long long *ts = (const unsigned long long *)( base + h->offset[TIMESTAMP] );
+	Bar b;
+
+	bars.reserve( bars.size() + h->numBars );
+	for ( unsigned long i = 0; i < h->numBars; ++i )
+	{
+		b.date		= ts[i] / 1000000;
+		b.time		= ts[i] % 1000000;
+		b.open		= ((const float *)( base + h->offset[OPEN] ))[i];
+		b.high		= ((const float *)( base + h->offset[HIGH] ))[i];
+		b.low		= ((const float *)( base + h->offset[LOW] ))[i];
+		b.close		= ((const float *)( base + h->offset[CLOSE] ))[i];
+		b.upticks	= ((const unsigned int *)( base + h->offset[UPTICKS] ))[i];
+		b.downticks	= ((const unsigned int *)( base + h->offset[DOWNTICKS] ))[i];
+		bars.push_back( b );
+	}
+}
+
+
+unsigned long ReturnsCache::getNumBars() const
+{
+	return _map ? ((const CacheHeader *)_map)->numBars : 0;
+}
+
+
+const void *ReturnsCache::column( Column c ) const
+{
+	return _map ? (const char *)_map + ((const CacheHeader *)_map)->offset[c] : NULL;
+}
+
+
+void ReturnsCache::unmap()
+{
+	if ( _map )
+	{
+		munmap( _map, _mapLen );
+		_map = NULL;
+		_mapLen = 0;
+	}
+}
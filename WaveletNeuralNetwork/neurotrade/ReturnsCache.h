@@ -0,0 +1,82 @@
+/*
+ * ReturnsCache.h
+ *  A binary, column by column copy of the bars and returns on disk,
+ *  mapped on startup so that the data files are parsed only when they change.
+ *  Created on: 26 Feb 2014
+ *      Author: jeevw
+ */
+
+#ifndef _NEUROTRADE_RETURNSCACHE_H_
+#define _NEUROTRADE_RETURNSCACHE_H_
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+#include "def.h"
+#include "SampleStore.h"
+#include "BarLoader.h"
+
+
+using namespace std;
+
+
+class ReturnsCache
+{
+  public:
+
+	enum Column { TIMESTAMP, OPEN, HIGH, LOW, CLOSE, UPTICKS, DOWNTICKS, RETURNS, NUM_COLUMNS };
+
+	ReturnsCache( const string &dataDir = Param::DBDataDir, const string &cacheDir = Param::CacheDir )
+		: _dataDir(dataDir), _cacheDir(cacheDir), _map(NULL), _mapLen(0)
+	{}
+	~ReturnsCache() { unmap(); }
+
+	/* Brings the cache up to date with the data directory and maps it.
+	 * A data file is parsed again only if its size or modification time changed
+	 * since it was cached. The store is attached to the mapped returns, so the
+	 * cache must outlive it. Returns the number of returns, or -1.
+	 */
+	long load( SampleStore &store );
+
+	unsigned long getNumBars() const;
+
+	const unsigned long long *getTimestamps() const	{ return (const unsigned long long *)column( TIMESTAMP ); }
+	const float *getOpen() const				{ return (const float *)column( OPEN ); }
+	const float *getHigh() const				{ return (const float *)column( HIGH ); }
+	const float *getLow() const					{ return (const float *)column( LOW ); }
+	const float *getClose() const				{ return (const float *)column( CLOSE ); }
+	const unsigned int *getUpticks() const		{ return (const unsigned int *)column( UPTICKS ); }
+	const unsigned int *getDownticks() const	{ return (const unsigned int *)column( DOWNTICKS ); }
+	const float *getReturns() const				{ return (const float *)column( RETURNS ); }
+
+
+  private:
+
+	string	_dataDir;
+	string	_cacheDir;
+
+	void	*_map;		// the series cache
+	size_t	_mapLen;
+
+	const void *column( Column c ) const;
+	void unmap();
+
+	// maps a cache file if it is there, sound and made for this key
+	static void *mapFile( const string &path, unsigned long long key, size_t &len );
+	static bool writeFile( const string &path, unsigned long long key,
+						   const vector<Bar> &bars, const float *returns, unsigned long numReturns );
+	static void readBars( const void *map, vector<Bar> &bars );
+
+	class FileTask;
+
+	bool rebuild( const vector<string> &files, const vector<unsigned long long> &keys,
+				  unsigned long long seriesKey );
+
+	// not copyable; the store may point into the mapping
+	ReturnsCache( const ReturnsCache & );
+	ReturnsCache &operator=( const ReturnsCache & );
+
+};
+
+#endif /* _NEUROTRADE_RETURNSCACHE_H_ */
@@ -0,0 +1,99 @@
+/*
+ * SampleStore.cpp
+ *
+ *  Created on: 22 Feb 2014
+ *      Author: jeevw
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+#include "SampleStore.h"
+
+
+
+SampleStore::SampleStore( unsigned int windowLength )
+	: _data(NULL), _size(0), _capacity(0), _windowLength(windowLength), _attached(false)
+{
+}
+
+SampleStore::~SampleStore()
+{
+	if ( !_attached ) free( _data );
+}
+
+
+void SampleStore::attach( const float *data, unsigned long n )
+{
+	if ( !_attached ) free( _data );
+
+	_data = const_cast<float *>( data );
+	_size = _capacity = n;
+	_attached = true;
+}
+
+
+void SampleStore::clear()
+{
+	if ( _attached )
+	{
+		_data = NULL;
+		_capacity = 0;
+		_attached = false;
+	}
+	_size = 0;
+}
+
+
+void SampleStore::reserve( unsigned long n )
+{
+	if ( n > _capacity )
+	{
+		grow( n );
+	}
+}
+
+
+float *SampleStore::extend( unsigned long n )
+{
+	float *p;
+
+	if ( _size + n > _capacity )
+	{
+		grow( _size + n );
+	}
+	p = _data + _size;
+	_size += n;
+
+	return p;
+}
+
+
+void SampleStore::grow( unsigned long minCapacity )
+{
+	unsigned long capacity = ( _capacity < 4096 ) ? 4096 : _capacity;
+	void *p = NULL;
+
+	while ( capacity < minCapacity )
+	{
+		capacity *= 2;
+	}
+
+	if ( posix_memalign( &p, Alignment, capacity * sizeof(float) ) != 0 )
+	{
+		Util::log( CRITICAL, "[SampleStore::grow()] Could not allocate the returns series of "
+							 + Util::itoa( capacity ) + " returns." );
+		throw bad_alloc();
+	}
+
+	if ( _size > 0 )
+	{
+		memcpy( p, _data, _size * sizeof(float) );
+	}
+	if ( !_attached ) free( _data );
+
+	_data = (float *)p;
+	_capacity = capacity;
+	_attached = false;
+}
@@ -0,0 +1,125 @@
+/*
+ * SampleStore.h
+ *  The returns series held once in a contiguous, aligned buffer,
+ *  and the sample windows over it.
+ *  Created on: 22 Feb 2014
+ *      Author: jeevw
+ */
+
+#ifndef _NEUROTRADE_SAMPLESTORE_H_
+#define _NEUROTRADE_SAMPLESTORE_H_
+
+#include <vector>
+
+#include "def.h"
+
+
+using namespace std;
+
+
+class SampleStore;
+
+
+/* A window [offset, offset + length) of the returns series.
+ * It does not own the data; it is valid for as long as the store it came from.
+ */
+class SampleView
+{
+  public:
+
+	SampleView()
+		: _store(NULL), _offset(0), _length(0)
+	{}
+
+	SampleView( const SampleStore *store, unsigned long offset, unsigned int length )
+		: _store(store), _offset(offset), _length(length)
+	{}
+
+	inline const float *data() const;
+
+	float operator[]( unsigned int i ) const { return data()[i]; }
+
+	unsigned int  size() const 		{ return _length; }
+	unsigned long getOffset() const	{ return _offset; }
+	const SampleStore *getStore() const	{ return _store; }
+
+	vector<float> toVector() const	{ return vector<float>( data(), data() + _length ); }
+
+  private:
+
+	const SampleStore	*_store;
+	unsigned long		_offset;
+	unsigned int		_length;
+
+};
+
+
+class SampleStore
+{
+  public:
+
+	static const unsigned int Alignment = 64;	// cache line
+
+	// A window is the input sample and the bars to predict.
+	SampleStore( unsigned int windowLength = Param::InputSampleSize + Param::NumPredBars );
+	~SampleStore();
+
+	void reserve( unsigned long n );
+	void clear();
+
+	void addReturn( float r )
+		{
+			if ( _size == _capacity ) grow( _size + 1 );
+			_data[_size++] = r;
+		}
+
+	// Appends n returns to be filled in by the caller; returns a pointer to the first.
+	float *extend( unsigned long n );
+
+	// Drops the returns after the first n.
+	void truncate( unsigned long n ) { if ( n < _size ) _size = n; }
+
+	/* Uses n returns that live elsewhere, e.g. in a mapped cache, without copying them.
+	 * They must outlive the store. The store never writes to them: adding returns
+	 * first copies them into a buffer of its own.
+	 */
+	void attach( const float *data, unsigned long n );
+
+	unsigned long getNumReturns() const		{ return _size; }
+	unsigned int  getWindowLength() const	{ return _windowLength; }
+
+	// The views taken from now on are of n returns; those taken before keep their length.
+	void setWindowLength( unsigned int n )	{ _windowLength = n; }
+
+	unsigned long getNumWindows() const
+		{ return ( _size < _windowLength ) ? 0 : _size - _windowLength + 1; }
+
+	SampleView getWindow( unsigned long i ) const
+		{ return SampleView( this, i, _windowLength ); }
+
+	const float *data() const { return _data; }
+
+
+  private:
+
+	float			*_data;
+	unsigned long	_size;
+	unsigned long	_capacity;
+	unsigned int	_windowLength;
+	bool			_attached;	// _data is not ours
+
+	void grow( unsigned long minCapacity );
+
+	// not copyable; the views point back to the store
+	SampleStore( const SampleStore & );
+	SampleStore &operator=( const SampleStore & );
+
+};
+
+
+inline const float *SampleView::data() const
+{
+	return _store->data() + _offset;
+}
+
+#endif /* _NEUROTRADE_SAMPLESTORE_H_ */
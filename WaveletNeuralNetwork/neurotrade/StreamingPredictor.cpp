@@ -0,0 +1,348 @@
+/*
+ * StreamingPredictor.cpp
+ *
+ *  Created on: 17 Mar 2014
+ *      Author: jeevw
+ */
+
+#include <math.h>
+#include <algorithm>
+
+#include "StreamingPredictor.h"
+#include "WaveletNN.h"
+#include "ModelSnapshot.h"
+#include "VectorKernels.h"
+
+
+
+StreamingPredictor::StreamingPredictor( const WaveletNN &nn )
+	: _n( Param::InputSampleSize ), _K( nn._kMeans.size() ), _ldc( AlignedArray::stride( Param::InputSampleSize ) ),
+	  _centres( nn._centres ), _centreNorms( nn._centreNorms ),
+	  _c( _centres.data() ), _cn( _centreNorms.empty() ? NULL : &_centreNorms[0] ), _scale( nn._scale ), _r_2( nn._r_2 ),
+	  _reach( nn._cutoff > 0 ? ( nn._cutoff * nn._radius ) * ( nn._cutoff * nn._radius ) : 0 ),
+	  _weights( _K + 1 ), _ring( 2 * _n ), _pos( 0 ), _numBars( 0 ), _h( _K + 1 ), _d( _K ),
+	  _online( false ), _forgetting( 1 ), _resyncInterval( 0 ), _normal( nn._normal ),
+	  _prev( _K + 1 ), _numUpdates( 0 ), _numResyncs( 0 )
+{
+	if ( nn._weights.dim() != (int)_K + 1 )
+	{
+		throw invalid_argument("[StreamingPredictor::StreamingPredictor()] The network is not trained.");
+	}
+	for ( unsigned int j = 0; j <= _K; ++j )
+	{
+		_weights[j] = nn._weights[j];
+	}
+	_h[0] = 1.0;
+}
+
+
+StreamingPredictor::StreamingPredictor( const ModelSnapshot &model )
+	: _n( Param::InputSampleSize ), _K( model.getK() ), _ldc( model.getStride() ),
+	  _c( model.getCentres() ), _cn( model.getCentreNorms() ), _scale( model.getScale() ), _r_2( model.getR2() ),
+	  _reach( model.getCutoff() > 0 ? ( model.getCutoff() * model.getRadius() ) * ( model.getCutoff() * model.getRadius() ) : 0 ),
+	  _weights( model.getWeights(), model.getWeights() + _K + 1 ), _ring( 2 * _n ), _pos( 0 ), _numBars( 0 ),
+	  _h( _K + 1 ), _d( _K ), _online( false ), _forgetting( 1 ), _resyncInterval( 0 ), _prev( _K + 1 ),
+	  _numUpdates( 0 ), _numResyncs( 0 )
+{
+	if ( !model.isMapped()  ||  model.getDimension() != _n )
+	{
+		throw invalid_argument("[StreamingPredictor::StreamingPredictor()] No model of this window is mapped.");
+	}
+	if ( model.getNumRows() > 0 )
+	{
+		_normal.set( _K + 1, model.getNumRows(), model.getGram(), model.getRhs() );
+	}
+	_h[0] = 1.0;
+}
+
+
+void StreamingPredictor::enableOnlineUpdates( double forgetting, unsigned int resyncInterval )
+{
+	if ( _normal.getSize() != _K + 1  ||  _normal.getNumRows() == 0 )
+	{
+		throw invalid_argument("[StreamingPredictor::enableOnlineUpdates()] The network has no Gram matrix to start from.");
+	}
+	if ( !( forgetting > 0  &&  forgetting <= 1 ) )
+	{
+		throw invalid_argument("[StreamingPredictor::enableOnlineUpdates()] The forgetting factor must be in (0, 1].");
+	}
+
+	_forgetting = forgetting;
+	_resyncInterval = max( resyncInterval, 1u );
+	_u.assign( _K + 1, 0.0 );
+	resync();
+	_online = true;
+}
+
+
+void StreamingPredictor::resync()
+{
+	vector<double> w;
+
+	_normal.solve( w );
+	_weights.swap( w );
+
+	// a Gram matrix too ill-conditioned to invert is steadied by a ridge far below its scale
+	if ( !_normal.invert( _P )  &&  !_normal.invert( _P, 1e-10 * _normal.getTrace() / ( _K + 1 ) ) )
+	{
+		throw domain_error("[StreamingPredictor::resync()] Cannot invert the Gram matrix.");
+	}
+	++_numResyncs;
+}
+
+
+// One step of recursive least squares, for hidden layer h and its target y.
+void StreamingPredictor::update( const float *h, double y )
+{
+	const unsigned int n = _K + 1;
+	const double invF = 1 / _forgetting;
+	double den = _forgetting, e = y, hj, ui, *Pj;
+	unsigned int i, j;
+
+	// u = P h, a column at a time, as P is symmetric; the loops then vectorise
+	fill( _u.begin(), _u.end(), 0.0 );
+	for ( j = 0; j < n; ++j )
+	{
+		Pj = &_P[ j * n ];
+		hj = h[j];
+		for ( i = 0; i < n; ++i )
+		{
+			_u[i] += Pj[i] * hj;
+		}
+	}
+	for ( i = 0; i < n; ++i )
+	{
+		den += h[i] * _u[i];
+		e -= _weights[i] * h[i];
+	}
+
+	// w += P h e / ( f + h'P h ), P = ( P - P h h'P / ( f + h'P h ) ) / f
+	for ( j = 0; j < n; ++j )
+	{
+		_weights[j] += _u[j] / den * e;
+
+		Pj = &_P[ j * n ];
+		ui = _u[j] / den;
+		for ( i = 0; i < n; ++i )
+		{
+			Pj[i] = ( Pj[i] - ui * _u[i] ) * invF;
+		}
+	}
+
+	if ( _forgetting != 1 )
+	{
+		_normal.scale( _forgetting );
+	}
+	_normal.addRow( h, y );
+
+	if ( ++_numUpdates % _resyncInterval == 0 )
+	{
+		resync();
+	}
+}
+
+
+double StreamingPredictor::getDrift() const
+{
+	vector<double> w;
+	double drift = 0;
+
+	_normal.solve( w );
+	for ( unsigned int j = 0; j < w.size(); ++j )
+	{
+		drift = max( drift, fabs( w[j] - _weights[j] ) );
+	}
+	return drift;
+}
+
+
+void StreamingPredictor::reset()
+{
+	_pos = 0;
+	_numBars = 0;
+}
+
+
+float StreamingPredictor::onBar( float r )
+{
+	const float *x;
+	float norm, t;
+	double y;
+
+	// the return the last window forecast is its target
+	if ( _online  &&  _numBars >= _n )
+	{
+		update( _prev.data(), r );
+	}
+
+	// the oldest return goes, in both its places
+	_ring[_pos] = r;
+	_ring[_pos + _n] = r;
+	_pos = ( _pos + 1 == _n ) ? 0 : _pos + 1;
+	if ( ++_numBars < _n )
+	{
+		return 0;
+	}
+
+	// the hidden layer as WaveletNN::hiddenLayer() makes it, for one sample
+	x = _ring.data() + _pos;
+	norm = VectorKernels::dot( x, x, _n );
+	VectorKernels::dotProducts( &x, 1, _c, _K, _ldc, _n, _h.data() + 1, _K );
+	for ( unsigned int j = 1; j <= _K; ++j )
+	{
+		t = norm + _cn[j-1] - 2 * _h[j];
+		_h[j] = _d[j-1] = ( t > 0 ) ? t : 0;
+	}
+	VectorKernels::mexicanHat( _h.data() + 1, _K, _scale, _r_2 );
+
+	// past the cutoff a mean's wavelet is 0, as the network's sparse hidden layer has it
+	if ( _reach > 0 )
+	{
+		for ( unsigned int j = 1; j <= _K; ++j )
+		{
+			if ( _d[j-1] > _reach )
+			{
+				_h[j] = 0;
+			}
+		}
+	}
+
+	y = 0;
+	for ( unsigned int j = 0; j <= _K; ++j )
+	{
+		y += _weights[j] * _h[j];
+	}
+	if ( _online )
+	{
+		copy( _h.data(), _h.data() + _K + 1, _prev.data() );
+	}
+	return y;
+}
+
+
+void StreamingPredictor::benchmark( const WaveletNN &nn, const SampleStore &store, bool online,
+									const ModelSnapshot *model )
+{
+	if ( model )
+	{
+		StreamingPredictor sp( *model );
+		benchmark( sp, nn, store, online );
+	}
+	else
+	{
+		StreamingPredictor sp( nn );
+		benchmark( sp, nn, store, online );
+	}
+}
+
+
+void StreamingPredictor::benchmark( StreamingPredictor &sp, const WaveletNN &nn, const SampleStore &store,
+									bool online )
+{
+	const unsigned long numReturns = store.getNumReturns(), numWindows = store.getNumWindows();
+	const unsigned int ldh = sp._K + 1;
+	vector<double> latency;
+	vector<float> fx;
+	vector<SampleView> windows;
+	double t0, t1, mean = 0, maxDiff = 0, f, y;
+	unsigned long i, hits = 0, calls = 0;
+
+	if ( numReturns < sp._n )
+	{
+		Util::log( ERROR, "[StreamingPredictor::benchmark()] Too few returns for a window." );
+		return;
+	}
+	latency.reserve( numReturns );
+	fx.reserve( numReturns );
+	if ( online )
+	{
+		sp.enableOnlineUpdates();
+	}
+
+	for ( i = 0; i < numReturns; ++i )
+	{
+		t0 = Util::getTime();
+		f = sp.onBar( store.data()[i] );
+		t1 = Util::getTime();
+		if ( sp.isReady() )
+		{
+			latency.push_back( t1 - t0 );
+			fx.push_back( f );
+		}
+	}
+
+	// a forecast hits when it has the sign of the return after its window
+	for ( i = 0; i + 1 < fx.size(); ++i )
+	{
+		y = store.data()[ i + sp._n ];
+		if ( y != 0 )
+		{
+			++calls;
+			hits += ( ( y > 0 ) == ( fx[i] > 0 ) );
+		}
+	}
+
+	if ( online )
+	{
+		Util::log( INFO, string("[StreamingPredictor::benchmark()] ") + Util::itoa( sp.getNumUpdates() )
+						 + " online updates with forgetting " + Util::ftoa( sp._forgetting ) + ", "
+						 + Util::itoa( sp.getNumResyncs() ) + " full solves; the weights are within "
+						 + Util::ftoa( sp.getDrift() ) + " of a full solve." );
+	}
+	else
+	{
+		// the same forecasts from the network, over the windows in a batch; sparse if it has a cutoff
+		windows.reserve( numWindows );
+		for ( i = 0; i < numWindows; ++i )
+		{
+			windows.push_back( store.getWindow(i) );
+		}
+		if ( nn._cutoff > 0 )
+		{
+			WaveletNN::SparseRows S;
+
+			nn.sparseHiddenLayer( windows, 0, numWindows, S );
+			for ( i = 0; i < numWindows; ++i )
+			{
+				f = 0;
+				for ( unsigned long a = S.start[i]; a < S.start[i+1]; ++a )
+				{
+					f += S.value[a] * sp._weights[ S.column[a] ];
+				}
+				maxDiff = max( maxDiff, fabs( f - fx[i] ) );
+			}
+		}
+		else
+		{
+			AlignedArray H( numWindows * ldh );
+
+			nn.hiddenLayer( windows, H.data(), ldh );
+			for ( i = 0; i < numWindows; ++i )
+			{
+				f = 0;
+				for ( unsigned int j = 0; j < ldh; ++j )
+				{
+					f += H[ i * ldh + j ] * sp._weights[j];
+				}
+				maxDiff = max( maxDiff, fabs( f - fx[i] ) );
+			}
+		}
+		Util::log( INFO, string("[StreamingPredictor::benchmark()] Largest difference from the batch forecasts: ")
+						 + Util::ftoa( maxDiff ) + "." );
+	}
+
+	for ( i = 0; i < latency.size(); ++i )
+	{
+		mean += latency[i];
+	}
+	mean /= latency.size();
+	sort( latency.begin(), latency.end() );
+
+	Util::log( INFO, string("[StreamingPredictor::benchmark()] ") + Util::itoa( latency.size() ) + " bars, K = "
+					 + Util::itoa( sp._K ) + ", " + VectorKernels::getISAName( VectorKernels::getISA() )
+					 + ": latency mean " + Util::ftoa( mean * 1e6 ) + " us, median "
+					 + Util::ftoa( latency[ latency.size() / 2 ] * 1e6 ) + " us, 99% "
+					 + Util::ftoa( latency[ latency.size() * 99 / 100 ] * 1e6 ) + " us, max "
+					 + Util::ftoa( latency.back() * 1e6 ) + " us; directional accuracy "
+					 + Util::ftoa( calls ? 100.0 * hits / calls : 0 ) + "%." );
+}
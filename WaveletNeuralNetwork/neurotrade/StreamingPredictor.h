@@ -0,0 +1,125 @@
+/*
+ * StreamingPredictor.h
+ *  Scores each new bar as it comes, from a copy of a trained network or
+ *  a mapped model: no allocation and no I/O once it is made.
+ *  Created on: 17 Mar 2014
+ *      Author: jeevw
+ */
+
+#ifndef _NEUROTRADE_STREAMINGPREDICTOR_H_
+#define _NEUROTRADE_STREAMINGPREDICTOR_H_
+
+#include <vector>
+
+#include "def.h"
+#include "AlignedArray.h"
+#include "SampleStore.h"
+#include "NormalEquations.h"
+
+
+using namespace std;
+
+
+class WaveletNN;
+class ModelSnapshot;
+
+
+class StreamingPredictor
+{
+  public:
+
+	// Copies the means, their norms, the wavelet constants, the cutoff and the weights of a trained network.
+	StreamingPredictor( const WaveletNN &nn );
+
+	/* Scores from the centres and norms of a mapped model in place, and copies
+	 * only the weights; the model must stay mapped while the predictor is used.
+	 */
+	StreamingPredictor( const ModelSnapshot &model );
+
+	/* Takes the next return and forecasts the one after it, from the last
+	 * Param::InputSampleSize returns. Returns 0 until there are that many.
+	 */
+	float onBar( float r );
+
+	/* Refits the weights as the bars come, by recursive least squares: each
+	 * bar's hidden layer and return update the inverse Gram matrix and the
+	 * weights in O(K^2), starting from the network's Gram matrix, with the
+	 * bars before weighed down by forgetting. The Gram matrix is kept as well,
+	 * and every resyncInterval updates the weights and the inverse are solved
+	 * from it again, in O(K^3), so rounding cannot build up; only those bars
+	 * allocate. Needs a network trained by trainWeights().
+	 */
+	void enableOnlineUpdates( double forgetting = Param::RLS_Forgetting,
+							  unsigned int resyncInterval = Param::RLS_Resync_Interval );
+
+	bool isUpdating() const { return _online; }
+	unsigned long getNumUpdates() const { return _numUpdates; }
+	unsigned long getNumResyncs() const { return _numResyncs; }
+
+	const vector<double> &getWeights() const { return _weights; }
+
+	// How far the weights have moved from a full solve of the Gram matrix, at most.
+	double getDrift() const;
+
+	bool isReady() const { return _numBars >= _n; }
+	unsigned long getNumBars() const { return _numBars; }
+
+	// Forgets the returns seen so far.
+	void reset();
+
+	/* Times onBar() over the returns of a store, after the first window fills,
+	 * and logs the mean and spread of the latency and the directional accuracy.
+	 * Checks the forecasts against the network's own on the same windows, or
+	 * if online, the weights against a full solve. Scores from the model if
+	 * one is given, which must be the network's.
+	 */
+	static void benchmark( const WaveletNN &nn, const SampleStore &store, bool online = false,
+						   const ModelSnapshot *model = NULL );
+
+
+  private:
+
+	unsigned int	_n;			// the window
+	unsigned int	_K;
+	unsigned int	_ldc;
+
+	AlignedArray	_centres;	// a row of _ldc floats a mean, if copied from a network
+	vector<float>	_centreNorms;
+	const float		*_c;		// the centres scored against, copied or mapped
+	const float		*_cn;		// and their norms
+	float			_scale;
+	float			_r_2;
+	float			_reach;		// the squared distance past which a wavelet is 0; 0 for no cutoff
+	vector<double>	_weights;	// the constant term first
+
+	/* The last _n returns, twice over: each return is written at i and i + _n,
+	 * so the window is always _n floats in a row, at _ring + _pos.
+	 */
+	AlignedArray	_ring;
+	unsigned int	_pos;
+	unsigned long	_numBars;
+
+	AlignedArray	_h;			// the hidden layer, 1 first
+	AlignedArray	_d;			// the squared distances of the window to the means
+
+	bool			_online;
+	double			_forgetting;
+	unsigned int	_resyncInterval;
+	NormalEquations	_normal;
+	vector<double>	_P;			// ( K+1 )^2, the inverse of the Gram matrix
+	vector<double>	_u;			// P h
+	AlignedArray	_prev;		// the hidden layer of the window before, waiting for its return
+	unsigned long	_numUpdates, _numResyncs;
+
+	void update( const float *h, double y );
+	void resync();
+
+	static void benchmark( StreamingPredictor &sp, const WaveletNN &nn, const SampleStore &store, bool online );
+
+	// not copyable; it may point into its own centres
+	StreamingPredictor( const StreamingPredictor & );
+	StreamingPredictor &operator=( const StreamingPredictor & );
+
+};
+
+#endif /* _NEUROTRADE_STREAMINGPREDICTOR_H_ */
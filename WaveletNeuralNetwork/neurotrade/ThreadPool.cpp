@@ -0,0 +1,257 @@
+/*
+ * ThreadPool.cpp
+ *
+ *  Created on: 28 Feb 2014
+ *      Author: jeevw
+ */
+
+#include <unistd.h>
+#include <stdexcept>
+
+#include "def.h"
+#include "ThreadPool.h"
+
+
+// the pool the current thread works for, if any
+static __thread const ThreadPool *t_pool = NULL;
+
+
+namespace
+{
+	class RangeChunk: public ThreadTask
+	{
+	  public:
+		RangeChunk( RangeTask &task, unsigned long begin, unsigned long end, unsigned int chunk )
+			: _task(task), _begin(begin), _end(end), _chunk(chunk)
+		{}
+		void run() { _task.run( _begin, _end, _chunk ); }
+	  private:
+		RangeTask		&_task;
+		unsigned long	_begin, _end;
+		unsigned int	_chunk;
+	};
+}
+
+
+ThreadPool::ThreadPool( unsigned int numThreads )
+	: _stop(false)
+{
+	pthread_t t;
+
+	pthread_mutex_init( &_mutex, NULL );
+	pthread_cond_init( &_work, NULL );
+	pthread_cond_init( &_done, NULL );
+
+	if ( numThreads == 0 )
+	{
+		numThreads = getNumCores();
+	}
+	for ( unsigned int i = 0; i < numThreads; ++i )
+	{
+		if ( pthread_create( &t, NULL, ThreadPool::worker, this ) != 0 )
+		{
+			Util::log( ERROR, string("[ThreadPool::ThreadPool()] Could only start ")
+							  + Util::itoa( i ) + " worker threads." );
+			break;
+		}
+		_threads.push_back( t );
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	pthread_mutex_lock( &_mutex );
+	_stop = true;
+	pthread_cond_broadcast( &_work );
+	pthread_mutex_unlock( &_mutex );
+
+	for ( unsigned int i = 0; i < _threads.size(); ++i )
+	{
+		pthread_join( _threads[i], NULL );
+	}
+
+	pthread_cond_destroy( &_done );
+	pthread_cond_destroy( &_work );
+	pthread_mutex_destroy( &_mutex );
+}
+
+
+unsigned int ThreadPool::getNumCores()
+{
+	long n = sysconf( _SC_NPROCESSORS_ONLN );
+	return ( n > 0 ) ? n : 1;
+}
+
+ThreadPool &ThreadPool::getDefault()
+{
+	static ThreadPool pool( Param::NumThreads );
+	return pool;
+}
+
+
+bool ThreadPool::inWorker() const
+{
+	return t_pool == this;
+}
+
+
+void *ThreadPool::worker( void *pool )
+{
+	t_pool = (ThreadPool *)pool;
+	((ThreadPool *)pool)->work();
+	return NULL;
+}
+
+static const string TaskFailed( "[ThreadPool::run()] A parallel task failed: " );
+
+
+// Runs a task; a failure is kept as its message, the same way whichever thread it runs in.
+static void runTask( ThreadTask *task, string &error )
+{
+	try
+	{
+		task->run();
+	}
+	catch ( exception &ex )
+	{
+		error = ex.what();
+	}
+	catch ( ... )
+	{
+		error = "unknown exception";
+	}
+}
+
+
+// The first failure of a batch, once; a nested batch's is not prefixed again.
+static void throwFailure( const string &error )
+{
+	if ( error.compare( 0, TaskFailed.size(), TaskFailed ) == 0 )
+	{
+		throw runtime_error( error );
+	}
+	throw runtime_error( TaskFailed + error );
+}
+
+
+void ThreadPool::work()
+{
+	Job job;
+
+	for ( ;; )
+	{
+		pthread_mutex_lock( &_mutex );
+		while ( _jobs.empty()  &&  !_stop )
+		{
+			pthread_cond_wait( &_work, &_mutex );
+		}
+		if ( _jobs.empty() )	// stopping
+		{
+			pthread_mutex_unlock( &_mutex );
+			return;
+		}
+		job = _jobs.front();
+		_jobs.pop_front();
+		pthread_mutex_unlock( &_mutex );
+
+		string error;
+		runTask( job.task, error );
+
+		pthread_mutex_lock( &_mutex );
+		if ( !error.empty()  &&  job.batch->error.empty() )
+		{
+			job.batch->error = error;
+		}
+		if ( --job.batch->pending == 0 )
+		{
+			pthread_cond_broadcast( &_done );
+		}
+		pthread_mutex_unlock( &_mutex );
+	}
+}
+
+
+void ThreadPool::run( const vector<ThreadTask *> &tasks )
+{
+	Batch batch;
+	Job job;
+
+	if ( tasks.empty() )
+	{
+		return;
+	}
+
+	// nothing to gain from the queue
+	if ( _threads.size() < 2  ||  tasks.size() == 1  ||  inWorker() )
+	{
+		for ( unsigned int i = 0; i < tasks.size(); ++i )
+		{
+			string error;
+
+			runTask( tasks[i], error );
+			if ( !error.empty()  &&  batch.error.empty() )
+			{
+				batch.error = error;
+			}
+		}
+		if ( !batch.error.empty() )
+		{
+			throwFailure( batch.error );
+		}
+		return;
+	}
+
+	batch.pending = tasks.size();
+	job.batch = &batch;
+
+	pthread_mutex_lock( &_mutex );
+	for ( unsigned int i = 0; i < tasks.size(); ++i )
+	{
+		job.task = tasks[i];
+		_jobs.push_back( job );
+	}
+	pthread_cond_broadcast( &_work );
+
+	while ( batch.pending > 0 )
+	{
+		pthread_cond_wait( &_done, &_mutex );
+	}
+	pthread_mutex_unlock( &_mutex );
+
+	if ( !batch.error.empty() )
+	{
+		throwFailure( batch.error );
+	}
+}
+
+
+void ThreadPool::parallelFor( unsigned long n, RangeTask &task, unsigned int numChunks )
+{
+	vector<RangeChunk> chunks;
+	vector<ThreadTask *> tasks;
+
+	if ( n == 0 )
+	{
+		return;
+	}
+	if ( numChunks == 0 )
+	{
+		numChunks = 4 * ( _threads.empty() ? 1 : _threads.size() );
+	}
+	if ( numChunks > n )
+	{
+		numChunks = n;
+	}
+
+	chunks.reserve( numChunks );
+	for ( unsigned int c = 0; c < numChunks; ++c )
+	{
+		chunks.push_back( RangeChunk( task, n * c / numChunks, n * (c + 1) / numChunks, c ) );
+	}
+	for ( unsigned int c = 0; c < numChunks; ++c )
+	{
+		tasks.push_back( &chunks[c] );
+	}
+
+	run( tasks );
+}
@@ -0,0 +1,97 @@
+/*
+ * ThreadPool.h
+ *  A fixed set of worker threads for the parallel stages.
+ *  Created on: 28 Feb 2014
+ *      Author: jeevw
+ */
+
+#ifndef _NEUROTRADE_THREADPOOL_H_
+#define _NEUROTRADE_THREADPOOL_H_
+
+#include <pthread.h>
+#include <vector>
+#include <deque>
+#include <string>
+
+
+using namespace std;
+
+
+class ThreadTask
+{
+  public:
+	virtual ~ThreadTask() {}
+	virtual void run() = 0;
+};
+
+
+/* Work over a range [0, n). run() is called once per chunk; chunk c always covers
+ * the same sub-range for the same n and number of chunks, whatever the number of
+ * threads, so per-chunk partial results can be reduced in a fixed order.
+ */
+class RangeTask
+{
+  public:
+	virtual ~RangeTask() {}
+	virtual void run( unsigned long begin, unsigned long end, unsigned int chunk ) = 0;
+};
+
+
+class ThreadPool
+{
+  public:
+
+	// 0 threads is one per online core
+	ThreadPool( unsigned int numThreads = 0 );
+	~ThreadPool();
+
+	/* Runs the tasks and returns when all of them are done.
+	 * Called from one of the pool's own workers, the tasks run in the caller's
+	 * thread, so that nested parallel stages cannot deadlock the pool.
+	 * If a task throws, the rest still run, and the first exception's message
+	 * is then rethrown as a runtime_error, whichever thread the tasks ran in.
+	 */
+	void run( const vector<ThreadTask *> &tasks );
+
+	// Splits [0, n) into numChunks chunks (0 for a few per thread) and runs them.
+	void parallelFor( unsigned long n, RangeTask &task, unsigned int numChunks = 0 );
+
+	unsigned int getNumThreads() const { return _threads.size(); }
+
+	static unsigned int getNumCores();
+
+	// The pool shared by the program, of Param::NumThreads threads.
+	static ThreadPool &getDefault();
+
+
+  private:
+
+	struct Batch
+	{
+		unsigned long	pending;
+		string			error;
+	};
+
+	struct Job
+	{
+		ThreadTask	*task;
+		Batch		*batch;
+	};
+
+	vector<pthread_t>	_threads;
+	deque<Job>			_jobs;
+	pthread_mutex_t		_mutex;
+	pthread_cond_t		_work;
+	pthread_cond_t		_done;
+	bool				_stop;
+
+	static void *worker( void *pool );
+	void work();
+	bool inWorker() const;
+
+	ThreadPool( const ThreadPool & );
+	ThreadPool &operator=( const ThreadPool & );
+
+};
+
+#endif /* _NEUROTRADE_THREADPOOL_H_ */
@@ -0,0 +1,117 @@
+/*
+ * VPTree.cpp
+ *
+ *  Created on: 14 Mar 2014
+ *      Author: jeevw
+ */
+
+#include <math.h>
+#include <algorithm>
+
+#include "VPTree.h"
+#include "VectorKernels.h"
+
+
+
+void VPTree::build( const float *points, unsigned int numPoints, unsigned int ldp, unsigned int n )
+{
+	vector<unsigned int> items( numPoints );
+
+	_nodes.clear();
+	_points = points;
+	_ldp = ldp;
+	_n = n;
+
+	for ( unsigned int i = 0; i < numPoints; ++i )
+	{
+		items[i] = i;
+	}
+	_nodes.reserve( numPoints );
+	build( items, 0, numPoints );
+}
+
+
+// The subtree over items [begin, end), with the first of them as its vantage point.
+int VPTree::build( vector<unsigned int> &items, unsigned int begin, unsigned int end )
+{
+	vector< pair<float, unsigned int> > dist;
+	unsigned int i, median;
+	Node node;
+	int n;
+
+	if ( begin == end )
+	{
+		return -1;
+	}
+
+	node.point = items[begin];
+	node.mu = 0;
+	node.inside = node.outside = -1;
+	n = _nodes.size();
+	_nodes.push_back( node );
+	if ( end - begin == 1 )
+	{
+		return n;
+	}
+
+	// split the rest at their median distance from the vantage point
+	for ( i = begin + 1; i < end; ++i )
+	{
+		dist.push_back( make_pair( sqrt( VectorKernels::squaredDistance( _points + (unsigned long)node.point * _ldp,
+																		 _points + (unsigned long)items[i] * _ldp, _n ) ),
+								   items[i] ) );
+	}
+	median = dist.size() / 2;
+	nth_element( dist.begin(), dist.begin() + median, dist.end() );
+	for ( i = 0; i < dist.size(); ++i )
+	{
+		items[ begin + 1 + i ] = dist[i].second;
+	}
+
+	_nodes[n].mu = dist[median].first;
+	_nodes[n].inside = build( items, begin + 1, begin + 1 + median );
+	_nodes[n].outside = build( items, begin + 1 + median, end );
+
+	return n;
+}
+
+
+unsigned int VPTree::within( const float *x, float radius, vector<unsigned int> &index, vector<float> &d2 ) const
+{
+	int stack[64], top = 0;
+	unsigned int measured = 0;
+	float d, dd;
+
+	if ( _nodes.empty() )
+	{
+		return 0;
+	}
+
+	// the tree is balanced, so its depth is about log2 of the points
+	stack[top++] = 0;
+	while ( top > 0 )
+	{
+		const Node &node = _nodes[ stack[--top] ];
+
+		dd = VectorKernels::squaredDistance( x, _points + (unsigned long)node.point * _ldp, _n );
+		d = sqrt( dd );
+		++measured;
+		if ( d <= radius )
+		{
+			index.push_back( node.point );
+			d2.push_back( dd );
+		}
+
+		// by the triangle inequality, a subtree may hold a point within the radius only if these hold
+		if ( node.inside >= 0  &&  d - radius <= node.mu )
+		{
+			stack[top++] = node.inside;
+		}
+		if ( node.outside >= 0  &&  d + radius >= node.mu )
+		{
+			stack[top++] = node.outside;
+		}
+	}
+
+	return measured;
+}
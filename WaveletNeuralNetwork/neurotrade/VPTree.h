@@ -0,0 +1,60 @@
+/*
+ * VPTree.h
+ *  A vantage point tree over a set of points, to find the points within a
+ *  distance of a query without measuring the distance to each of them.
+ *  Created on: 14 Mar 2014
+ *      Author: jeevw
+ */
+
+#ifndef _NEUROTRADE_VPTREE_H_
+#define _NEUROTRADE_VPTREE_H_
+
+#include <vector>
+
+
+using namespace std;
+
+
+class VPTree
+{
+  public:
+
+	VPTree() : _points(NULL), _ldp(0), _n(0) {}
+
+	/* Builds the tree over numPoints rows of n floats, ldp floats apart.
+	 * The points are not copied; they must outlive the tree.
+	 */
+	void build( const float *points, unsigned int numPoints, unsigned int ldp, unsigned int n );
+
+	void clear() { _nodes.clear(); _points = NULL; }
+
+	bool empty() const { return _nodes.empty(); }
+
+	/* Appends the index and squared distance of every point within radius
+	 * of x, in the order the tree finds them. Returns the number of distances
+	 * it measured to find them.
+	 */
+	unsigned int within( const float *x, float radius, vector<unsigned int> &index, vector<float> &d2 ) const;
+
+
+  private:
+
+	/* The points at most mu from the node's point are in the inside subtree,
+	 * those at least mu in the outside one; -1 for none.
+	 */
+	struct Node
+	{
+		unsigned int	point;
+		float			mu;
+		int				inside, outside;
+	};
+
+	vector<Node>	_nodes;		// the root first
+	const float		*_points;
+	unsigned int	_ldp, _n;
+
+	int build( vector<unsigned int> &items, unsigned int begin, unsigned int end );
+
+};
+
+#endif /* _NEUROTRADE_VPTREE_H_ */
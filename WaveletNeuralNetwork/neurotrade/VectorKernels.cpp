@@ -0,0 +1,637 @@
+/*
+ * VectorKernels.cpp
+ *
+ *  The kernels must add and multiply in exactly the order written; they are
+ *  built without floating point contraction (-ffp-contract=off) so that no FMA
+ *  creeps into one of them and not the others.
+ *
+ *  The kernels over a window are templates on its length N: an instance for
+ *  one of VectorKernels::Windows takes n as the constant N, so its loops are
+ *  unrolled whole, and N = 0 is the one for any other n. Each adds the same
+ *  terms in the same order whatever N, so the results do not change with it.
+ *
+ *  Created on: 3 Mar 2014
+ *      Author: jeevw
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NEUROTRADE_X86
+#include <immintrin.h>
+#endif
+
+#include "def.h"
+#include "VectorKernels.h"
+
+
+#include <math.h>
+
+
+const VectorKernels::Kernels *VectorKernels::_kernels = NULL;
+VectorKernels::ISA VectorKernels::_isa = VectorKernels::NUM_ISAS;	// not picked yet
+
+
+//***************************************************************************************
+// Scalar; the reference the vector kernels follow
+
+static inline float reduce16( float *s )
+{
+	unsigned int j;
+
+	for ( j = 0; j < 8; ++j ) s[j] += s[j+8];
+	for ( j = 0; j < 4; ++j ) s[j] += s[j+4];
+	for ( j = 0; j < 2; ++j ) s[j] += s[j+2];
+	return s[0] + s[1];
+}
+
+static inline float tailSquaredDistance( const float *a, const float *b, unsigned int i, unsigned int n )
+{
+	float t = 0, d;
+
+	for ( ; i < n; ++i )
+	{
+		d = a[i] - b[i];
+		t += d * d;
+	}
+	return t;
+}
+
+static inline float tailDot( const float *a, const float *b, unsigned int i, unsigned int n )
+{
+	float t = 0;
+
+	for ( ; i < n; ++i )
+	{
+		t += a[i] * b[i];
+	}
+	return t;
+}
+
+template <unsigned int N>
+static float squaredDistanceScalar( const float *a, const float *b, unsigned int n )
+{
+	float s[16] = { 0 }, d;
+	unsigned int i = 0, j;
+
+	if ( N ) n = N;
+	for ( ; i + 16 <= n; i += 16 )
+	{
+		for ( j = 0; j < 16; ++j )
+		{
+			d = a[i+j] - b[i+j];
+			s[j] += d * d;
+		}
+	}
+	return reduce16( s ) + tailSquaredDistance( a, b, i, n );
+}
+
+template <unsigned int N>
+static float dotScalar( const float *a, const float *b, unsigned int n )
+{
+	float s[16] = { 0 };
+	unsigned int i = 0, j;
+
+	if ( N ) n = N;
+	for ( ; i + 16 <= n; i += 16 )
+	{
+		for ( j = 0; j < 16; ++j )
+		{
+			s[j] += a[i+j] * b[i+j];
+		}
+	}
+	return reduce16( s ) + tailDot( a, b, i, n );
+}
+
+// one product at a time, for the instruction sets without a blocked kernel
+static inline void dotProductsPairwise( float (*dot)( const float *, const float *, unsigned int ),
+										const float *const *rows, unsigned int numRows,
+										const float *centres, unsigned int numCentres, unsigned int ldc,
+										unsigned int n, float *out, unsigned int ldo )
+{
+	for ( unsigned int i = 0; i < numRows; ++i )
+	{
+		for ( unsigned int j = 0; j < numCentres; ++j )
+		{
+			out[ i * ldo + j ] = dot( rows[i], centres + j * ldc, n );
+		}
+	}
+}
+
+template <unsigned int N>
+static void dotProductsScalar( const float *const *rows, unsigned int numRows,
+							   const float *centres, unsigned int numCentres, unsigned int ldc,
+							   unsigned int n, float *out, unsigned int ldo )
+{
+	dotProductsPairwise( dotScalar<N>, rows, numRows, centres, numCentres, ldc, n, out, ldo );
+}
+
+
+/* exp() as in Cephes expf: x = n ln2 + r, exp(r) by a polynomial, times 2^n.
+ * The vector kernels take exactly these steps.
+ */
+static const float ExpHi		= 88.3762626647949f;
+static const float ExpLo		= -88.3762626647949f;
+static const float Log2e		= 1.44269504088896341f;
+static const float Ln2Hi		= 0.693359375f;
+static const float Ln2Lo		= -2.12194440e-4f;
+static const float ExpP[6]		= { 1.9875691500E-4f, 1.3981999507E-3f, 8.3334519073E-3f,
+									4.1665795894E-2f, 1.6666665459E-1f, 5.0000001201E-1f };
+
+static inline float expPoly( float x )
+{
+	union { int i; float f; } p2n;
+	float fx, z, y;
+
+	if ( x > ExpHi ) x = ExpHi;
+	if ( x < ExpLo ) x = ExpLo;
+
+	fx = floorf( x * Log2e + 0.5f );
+	x = x - fx * Ln2Hi;
+	x = x - fx * Ln2Lo;
+	z = x * x;
+
+	y = ExpP[0];
+	y = y * x + ExpP[1];
+	y = y * x + ExpP[2];
+	y = y * x + ExpP[3];
+	y = y * x + ExpP[4];
+	y = y * x + ExpP[5];
+	y = y * z + x;
+	y = y + 1.0f;
+
+	p2n.i = ( (int)fx + 127 ) << 23;
+	return y * p2n.f;
+}
+
+static inline float mexicanHat1( float t, float A, float r_2 )
+{
+	float u = t * r_2;
+	return ( A * ( 1.0f - u ) ) * expPoly( u * -0.5f );
+}
+
+static void mexicanHatScalar( float *t, unsigned int n, float A, float r_2 )
+{
+	for ( unsigned int i = 0; i < n; ++i )
+	{
+		t[i] = mexicanHat1( t[i], A, r_2 );
+	}
+}
+
+
+// the kernels of an instruction set for each of VectorKernels::Windows, and any other window first
+#define WINDOW_KERNELS( squaredDistance, dot, dotProducts, mexicanHat ) \
+	{ { squaredDistance<0>,   dot<0>,   dotProducts<0>,   mexicanHat }, \
+	  { squaredDistance<16>,  dot<16>,  dotProducts<16>,  mexicanHat }, \
+	  { squaredDistance<32>,  dot<32>,  dotProducts<32>,  mexicanHat }, \
+	  { squaredDistance<64>,  dot<64>,  dotProducts<64>,  mexicanHat }, \
+	  { squaredDistance<80>,  dot<80>,  dotProducts<80>,  mexicanHat }, \
+	  { squaredDistance<128>, dot<128>, dotProducts<128>, mexicanHat } }
+
+
+#ifdef NEUROTRADE_X86
+
+//***************************************************************************************
+// SSE2: four registers of four lanes
+
+__attribute__((target("sse2")))
+static inline float reduce4( __m128 s4 )
+{
+	__m128 s2 = _mm_add_ps( s4, _mm_movehl_ps( s4, s4 ) );			// j + j+2
+	__m128 s1 = _mm_add_ss( s2, _mm_shuffle_ps( s2, s2, 1 ) );		// 0 + 1
+	return _mm_cvtss_f32( s1 );
+}
+
+template <unsigned int N>
+__attribute__((target("sse2")))
+static float squaredDistanceSSE2( const float *a, const float *b, unsigned int n )
+{
+	__m128 s0 = _mm_setzero_ps(), s1 = s0, s2 = s0, s3 = s0, d;
+	unsigned int i = 0;
+
+	if ( N ) n = N;
+	for ( ; i + 16 <= n; i += 16 )
+	{
+		d = _mm_sub_ps( _mm_loadu_ps( a + i ),      _mm_loadu_ps( b + i ) );
+		s0 = _mm_add_ps( s0, _mm_mul_ps( d, d ) );
+		d = _mm_sub_ps( _mm_loadu_ps( a + i + 4 ),  _mm_loadu_ps( b + i + 4 ) );
+		s1 = _mm_add_ps( s1, _mm_mul_ps( d, d ) );
+		d = _mm_sub_ps( _mm_loadu_ps( a + i + 8 ),  _mm_loadu_ps( b + i + 8 ) );
+		s2 = _mm_add_ps( s2, _mm_mul_ps( d, d ) );
+		d = _mm_sub_ps( _mm_loadu_ps( a + i + 12 ), _mm_loadu_ps( b + i + 12 ) );
+		s3 = _mm_add_ps( s3, _mm_mul_ps( d, d ) );
+	}
+
+	// j + j+8, then j + j+4
+	__m128 s4 = _mm_add_ps( _mm_add_ps( s0, s2 ), _mm_add_ps( s1, s3 ) );
+
+	return reduce4( s4 ) + tailSquaredDistance( a, b, i, n );
+}
+
+template <unsigned int N>
+__attribute__((target("sse2")))
+static float dotSSE2( const float *a, const float *b, unsigned int n )
+{
+	__m128 s0 = _mm_setzero_ps(), s1 = s0, s2 = s0, s3 = s0;
+	unsigned int i = 0;
+
+	if ( N ) n = N;
+	for ( ; i + 16 <= n; i += 16 )
+	{
+		s0 = _mm_add_ps( s0, _mm_mul_ps( _mm_loadu_ps( a + i ),      _mm_loadu_ps( b + i ) ) );
+		s1 = _mm_add_ps( s1, _mm_mul_ps( _mm_loadu_ps( a + i + 4 ),  _mm_loadu_ps( b + i + 4 ) ) );
+		s2 = _mm_add_ps( s2, _mm_mul_ps( _mm_loadu_ps( a + i + 8 ),  _mm_loadu_ps( b + i + 8 ) ) );
+		s3 = _mm_add_ps( s3, _mm_mul_ps( _mm_loadu_ps( a + i + 12 ), _mm_loadu_ps( b + i + 12 ) ) );
+	}
+
+	return reduce4( _mm_add_ps( _mm_add_ps( s0, s2 ), _mm_add_ps( s1, s3 ) ) ) + tailDot( a, b, i, n );
+}
+
+template <unsigned int N>
+static void dotProductsSSE2( const float *const *rows, unsigned int numRows,
+							 const float *centres, unsigned int numCentres, unsigned int ldc,
+							 unsigned int n, float *out, unsigned int ldo )
+{
+	dotProductsPairwise( dotSSE2<N>, rows, numRows, centres, numCentres, ldc, n, out, ldo );
+}
+
+
+//***************************************************************************************
+// AVX2: two registers of eight lanes
+
+__attribute__((target("avx2")))
+static inline float reduce8( __m256 s8 )
+{
+	__m128 s4 = _mm_add_ps( _mm256_castps256_ps128( s8 ), _mm256_extractf128_ps( s8, 1 ) );	// j + j+4
+	__m128 s2 = _mm_add_ps( s4, _mm_movehl_ps( s4, s4 ) );
+	__m128 s1 = _mm_add_ss( s2, _mm_shuffle_ps( s2, s2, 1 ) );
+	return _mm_cvtss_f32( s1 );
+}
+
+template <unsigned int N>
+__attribute__((target("avx2")))
+static float squaredDistanceAVX2( const float *a, const float *b, unsigned int n )
+{
+	__m256 s0 = _mm256_setzero_ps(), s1 = s0, d;
+	unsigned int i = 0;
+
+	if ( N ) n = N;
+	for ( ; i + 16 <= n; i += 16 )
+	{
+		d = _mm256_sub_ps( _mm256_loadu_ps( a + i ),     _mm256_loadu_ps( b + i ) );
+		s0 = _mm256_add_ps( s0, _mm256_mul_ps( d, d ) );
+		d = _mm256_sub_ps( _mm256_loadu_ps( a + i + 8 ), _mm256_loadu_ps( b + i + 8 ) );
+		s1 = _mm256_add_ps( s1, _mm256_mul_ps( d, d ) );
+	}
+
+	return reduce8( _mm256_add_ps( s0, s1 ) ) + tailSquaredDistance( a, b, i, n );	// j + j+8
+}
+
+template <unsigned int N>
+__attribute__((target("avx2")))
+static float dotAVX2( const float *a, const float *b, unsigned int n )
+{
+	__m256 s0 = _mm256_setzero_ps(), s1 = s0;
+	unsigned int i = 0;
+
+	if ( N ) n = N;
+	for ( ; i + 16 <= n; i += 16 )
+	{
+		s0 = _mm256_add_ps( s0, _mm256_mul_ps( _mm256_loadu_ps( a + i ),     _mm256_loadu_ps( b + i ) ) );
+		s1 = _mm256_add_ps( s1, _mm256_mul_ps( _mm256_loadu_ps( a + i + 8 ), _mm256_loadu_ps( b + i + 8 ) ) );
+	}
+
+	return reduce8( _mm256_add_ps( s0, s1 ) ) + tailDot( a, b, i, n );
+}
+
+// 2 rows x 2 centres at a time, two accumulators (lanes 0-7, 8-15) for each product
+template <unsigned int N>
+__attribute__((target("avx2")))
+static void dotProductsAVX2( const float *const *rows, unsigned int numRows,
+							 const float *centres, unsigned int numCentres, unsigned int ldc,
+							 unsigned int n, float *out, unsigned int ldo )
+{
+	unsigned int i = 0, j, k, n16;
+
+	if ( N ) n = N;
+	n16 = n / 16 * 16;
+
+	for ( ; i + 2 <= numRows; i += 2 )
+	{
+		const float *x0 = rows[i], *x1 = rows[i+1];
+
+		for ( j = 0; j + 2 <= numCentres; j += 2 )
+		{
+			const float *c0 = centres + j * ldc, *c1 = c0 + ldc;
+			__m256 s00a = _mm256_setzero_ps(), s00b = s00a, s01a = s00a, s01b = s00a;
+			__m256 s10a = s00a, s10b = s00a, s11a = s00a, s11b = s00a;
+			__m256 xa, xb, ya, yb, ca, cb;
+
+			for ( k = 0; k < n16; k += 16 )
+			{
+				xa = _mm256_loadu_ps( x0 + k );		xb = _mm256_loadu_ps( x0 + k + 8 );
+				ya = _mm256_loadu_ps( x1 + k );		yb = _mm256_loadu_ps( x1 + k + 8 );
+
+				ca = _mm256_loadu_ps( c0 + k );		cb = _mm256_loadu_ps( c0 + k + 8 );
+				s00a = _mm256_add_ps( s00a, _mm256_mul_ps( xa, ca ) );
+				s00b = _mm256_add_ps( s00b, _mm256_mul_ps( xb, cb ) );
+				s10a = _mm256_add_ps( s10a, _mm256_mul_ps( ya, ca ) );
+				s10b = _mm256_add_ps( s10b, _mm256_mul_ps( yb, cb ) );
+
+				ca = _mm256_loadu_ps( c1 + k );		cb = _mm256_loadu_ps( c1 + k + 8 );
+				s01a = _mm256_add_ps( s01a, _mm256_mul_ps( xa, ca ) );
+				s01b = _mm256_add_ps( s01b, _mm256_mul_ps( xb, cb ) );
+				s11a = _mm256_add_ps( s11a, _mm256_mul_ps( ya, ca ) );
+				s11b = _mm256_add_ps( s11b, _mm256_mul_ps( yb, cb ) );
+			}
+
+			out[ i * ldo + j ]			= reduce8( _mm256_add_ps( s00a, s00b ) ) + tailDot( x0, c0, n16, n );
+			out[ i * ldo + j + 1 ]		= reduce8( _mm256_add_ps( s01a, s01b ) ) + tailDot( x0, c1, n16, n );
+			out[ (i+1) * ldo + j ]		= reduce8( _mm256_add_ps( s10a, s10b ) ) + tailDot( x1, c0, n16, n );
+			out[ (i+1) * ldo + j + 1 ]	= reduce8( _mm256_add_ps( s11a, s11b ) ) + tailDot( x1, c1, n16, n );
+		}
+		for ( ; j < numCentres; ++j )
+		{
+			out[ i * ldo + j ]		= dotAVX2<N>( x0, centres + j * ldc, n );
+			out[ (i+1) * ldo + j ]	= dotAVX2<N>( x1, centres + j * ldc, n );
+		}
+	}
+	for ( ; i < numRows; ++i )
+	{
+		for ( j = 0; j < numCentres; ++j )
+		{
+			out[ i * ldo + j ] = dotAVX2<N>( rows[i], centres + j * ldc, n );
+		}
+	}
+}
+
+__attribute__((target("avx2")))
+static void mexicanHatAVX2( float *t, unsigned int n, float A, float r_2 )
+{
+	const __m256 hi = _mm256_set1_ps( ExpHi ), lo = _mm256_set1_ps( ExpLo );
+	const __m256 log2e = _mm256_set1_ps( Log2e ), half = _mm256_set1_ps( 0.5f ), one = _mm256_set1_ps( 1.0f );
+	const __m256 ln2hi = _mm256_set1_ps( Ln2Hi ), ln2lo = _mm256_set1_ps( Ln2Lo );
+	const __m256 a = _mm256_set1_ps( A ), r2 = _mm256_set1_ps( r_2 ), mhalf = _mm256_set1_ps( -0.5f );
+	const __m256i bias = _mm256_set1_epi32( 127 );
+	__m256 u, x, fx, z, y, w;
+	unsigned int i = 0;
+
+	for ( ; i + 8 <= n; i += 8 )
+	{
+		u = _mm256_mul_ps( _mm256_loadu_ps( t + i ), r2 );
+		w = _mm256_mul_ps( a, _mm256_sub_ps( one, u ) );
+
+		x = _mm256_mul_ps( u, mhalf );
+		x = _mm256_min_ps( x, hi );
+		x = _mm256_max_ps( x, lo );
+
+		fx = _mm256_floor_ps( _mm256_add_ps( _mm256_mul_ps( x, log2e ), half ) );
+		x = _mm256_sub_ps( x, _mm256_mul_ps( fx, ln2hi ) );
+		x = _mm256_sub_ps( x, _mm256_mul_ps( fx, ln2lo ) );
+		z = _mm256_mul_ps( x, x );
+
+		y = _mm256_set1_ps( ExpP[0] );
+		y = _mm256_add_ps( _mm256_mul_ps( y, x ), _mm256_set1_ps( ExpP[1] ) );
+		y = _mm256_add_ps( _mm256_mul_ps( y, x ), _mm256_set1_ps( ExpP[2] ) );
+		y = _mm256_add_ps( _mm256_mul_ps( y, x ), _mm256_set1_ps( ExpP[3] ) );
+		y = _mm256_add_ps( _mm256_mul_ps( y, x ), _mm256_set1_ps( ExpP[4] ) );
+		y = _mm256_add_ps( _mm256_mul_ps( y, x ), _mm256_set1_ps( ExpP[5] ) );
+		y = _mm256_add_ps( _mm256_mul_ps( y, z ), x );
+		y = _mm256_add_ps( y, one );
+
+		y = _mm256_mul_ps( y, _mm256_castsi256_ps( _mm256_slli_epi32(
+					_mm256_add_epi32( _mm256_cvttps_epi32( fx ), bias ), 23 ) ) );
+
+		_mm256_storeu_ps( t + i, _mm256_mul_ps( w, y ) );
+	}
+	for ( ; i < n; ++i )
+	{
+		t[i] = mexicanHat1( t[i], A, r_2 );
+	}
+}
+
+
+//***************************************************************************************
+// AVX-512: one register of sixteen lanes
+
+__attribute__((target("avx512f")))
+static inline float reduce16( __m512 s )
+{
+	// j + j+8; the masked extracts keep clear of _mm256_undefined_pd()
+	__m256d z = _mm256_setzero_pd();
+	__m256 s8 = _mm256_add_ps( _mm256_castpd_ps( _mm512_mask_extractf64x4_pd( z, 0xF, _mm512_castps_pd( s ), 0 ) ),
+							   _mm256_castpd_ps( _mm512_mask_extractf64x4_pd( z, 0xF, _mm512_castps_pd( s ), 1 ) ) );
+	return reduce8( s8 );
+}
+
+template <unsigned int N>
+__attribute__((target("avx512f")))
+static float squaredDistanceAVX512( const float *a, const float *b, unsigned int n )
+{
+	__m512 s = _mm512_setzero_ps(), d;
+	unsigned int i = 0;
+
+	if ( N ) n = N;
+	for ( ; i + 16 <= n; i += 16 )
+	{
+		d = _mm512_sub_ps( _mm512_loadu_ps( a + i ), _mm512_loadu_ps( b + i ) );
+		s = _mm512_add_ps( s, _mm512_mul_ps( d, d ) );
+	}
+
+	return reduce16( s ) + tailSquaredDistance( a, b, i, n );
+}
+
+template <unsigned int N>
+__attribute__((target("avx512f")))
+static float dotAVX512( const float *a, const float *b, unsigned int n )
+{
+	__m512 s = _mm512_setzero_ps();
+	unsigned int i = 0;
+
+	if ( N ) n = N;
+	for ( ; i + 16 <= n; i += 16 )
+	{
+		s = _mm512_add_ps( s, _mm512_mul_ps( _mm512_loadu_ps( a + i ), _mm512_loadu_ps( b + i ) ) );
+	}
+
+	return reduce16( s ) + tailDot( a, b, i, n );
+}
+
+// 4 rows x 4 centres at a time, one accumulator for each product
+template <unsigned int N>
+__attribute__((target("avx512f")))
+static void dotProductsAVX512( const float *const *rows, unsigned int numRows,
+							   const float *centres, unsigned int numCentres, unsigned int ldc,
+							   unsigned int n, float *out, unsigned int ldo )
+{
+	unsigned int i = 0, j, k, r, c, n16;
+
+	if ( N ) n = N;
+	n16 = n / 16 * 16;
+
+	for ( ; i + 4 <= numRows; i += 4 )
+	{
+		for ( j = 0; j + 4 <= numCentres; j += 4 )
+		{
+			const float *cj = centres + j * ldc;
+			__m512 s[4][4], x[4], cc;
+
+			for ( r = 0; r < 4; ++r )
+				for ( c = 0; c < 4; ++c )
+					s[r][c] = _mm512_setzero_ps();
+
+			for ( k = 0; k < n16; k += 16 )
+			{
+				for ( r = 0; r < 4; ++r )
+				{
+					x[r] = _mm512_loadu_ps( rows[i+r] + k );
+				}
+				for ( c = 0; c < 4; ++c )
+				{
+					cc = _mm512_loadu_ps( cj + c * ldc + k );
+					for ( r = 0; r < 4; ++r )
+					{
+						s[r][c] = _mm512_add_ps( s[r][c], _mm512_mul_ps( x[r], cc ) );
+					}
+				}
+			}
+
+			for ( r = 0; r < 4; ++r )
+				for ( c = 0; c < 4; ++c )
+					out[ (i+r) * ldo + j + c ] = reduce16( s[r][c] ) + tailDot( rows[i+r], cj + c * ldc, n16, n );
+		}
+		for ( ; j < numCentres; ++j )
+		{
+			for ( r = 0; r < 4; ++r )
+			{
+				out[ (i+r) * ldo + j ] = dotAVX512<N>( rows[i+r], centres + j * ldc, n );
+			}
+		}
+	}
+	for ( ; i < numRows; ++i )
+	{
+		for ( j = 0; j < numCentres; ++j )
+		{
+			out[ i * ldo + j ] = dotAVX512<N>( rows[i], centres + j * ldc, n );
+		}
+	}
+}
+
+__attribute__((target("avx512f")))
+static void mexicanHatAVX512( float *t, unsigned int n, float A, float r_2 )
+{
+	const __m512 hi = _mm512_set1_ps( ExpHi ), lo = _mm512_set1_ps( ExpLo );
+	const __m512 log2e = _mm512_set1_ps( Log2e ), half = _mm512_set1_ps( 0.5f ), one = _mm512_set1_ps( 1.0f );
+	const __m512 ln2hi = _mm512_set1_ps( Ln2Hi ), ln2lo = _mm512_set1_ps( Ln2Lo );
+	const __m512 a = _mm512_set1_ps( A ), r2 = _mm512_set1_ps( r_2 ), mhalf = _mm512_set1_ps( -0.5f );
+	const __m512i bias = _mm512_set1_epi32( 127 );
+	const __mmask16 All = 0xFFFF;	// zero-masked forms, as in reduce16()
+	__m512 u, x, fx, z, y, w;
+	unsigned int i = 0;
+
+	for ( ; i + 16 <= n; i += 16 )
+	{
+		u = _mm512_mul_ps( _mm512_loadu_ps( t + i ), r2 );
+		w = _mm512_mul_ps( a, _mm512_sub_ps( one, u ) );
+
+		x = _mm512_mul_ps( u, mhalf );
+		x = _mm512_maskz_min_ps( All, x, hi );
+		x = _mm512_maskz_max_ps( All, x, lo );
+
+		fx = _mm512_maskz_roundscale_ps( All, _mm512_add_ps( _mm512_mul_ps( x, log2e ), half ),
+										 _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC );
+		x = _mm512_sub_ps( x, _mm512_mul_ps( fx, ln2hi ) );
+		x = _mm512_sub_ps( x, _mm512_mul_ps( fx, ln2lo ) );
+		z = _mm512_mul_ps( x, x );
+
+		y = _mm512_set1_ps( ExpP[0] );
+		y = _mm512_add_ps( _mm512_mul_ps( y, x ), _mm512_set1_ps( ExpP[1] ) );
+		y = _mm512_add_ps( _mm512_mul_ps( y, x ), _mm512_set1_ps( ExpP[2] ) );
+		y = _mm512_add_ps( _mm512_mul_ps( y, x ), _mm512_set1_ps( ExpP[3] ) );
+		y = _mm512_add_ps( _mm512_mul_ps( y, x ), _mm512_set1_ps( ExpP[4] ) );
+		y = _mm512_add_ps( _mm512_mul_ps( y, x ), _mm512_set1_ps( ExpP[5] ) );
+		y = _mm512_add_ps( _mm512_mul_ps( y, z ), x );
+		y = _mm512_add_ps( y, one );
+
+		y = _mm512_mul_ps( y, _mm512_castsi512_ps( _mm512_maskz_slli_epi32( All,
+					_mm512_add_epi32( _mm512_maskz_cvttps_epi32( All, fx ), bias ), 23 ) ) );
+
+		_mm512_storeu_ps( t + i, _mm512_mul_ps( w, y ) );
+	}
+	for ( ; i < n; ++i )
+	{
+		t[i] = mexicanHat1( t[i], A, r_2 );
+	}
+}
+
+
+static const VectorKernels::Kernels KernelTable[ VectorKernels::NUM_ISAS ][ VectorKernels::NUM_WINDOWS ] =
+{
+	WINDOW_KERNELS( squaredDistanceScalar, dotScalar, dotProductsScalar, mexicanHatScalar ),
+	WINDOW_KERNELS( squaredDistanceSSE2,   dotSSE2,   dotProductsSSE2,   mexicanHatScalar ),	// no floor in SSE2
+	WINDOW_KERNELS( squaredDistanceAVX2,   dotAVX2,   dotProductsAVX2,   mexicanHatAVX2 ),
+	WINDOW_KERNELS( squaredDistanceAVX512, dotAVX512, dotProductsAVX512, mexicanHatAVX512 )
+};
+
+#else
+
+static const VectorKernels::Kernels KernelTable[ VectorKernels::NUM_ISAS ][ VectorKernels::NUM_WINDOWS ] =
+{
+	WINDOW_KERNELS( squaredDistanceScalar, dotScalar, dotProductsScalar, mexicanHatScalar ),
+	WINDOW_KERNELS( squaredDistanceScalar, dotScalar, dotProductsScalar, mexicanHatScalar ),
+	WINDOW_KERNELS( squaredDistanceScalar, dotScalar, dotProductsScalar, mexicanHatScalar ),
+	WINDOW_KERNELS( squaredDistanceScalar, dotScalar, dotProductsScalar, mexicanHatScalar )
+};
+
+#endif
+
+
+
+bool VectorKernels::isSupported( ISA isa )
+{
+#ifdef NEUROTRADE_X86
+	__builtin_cpu_init();
+	switch ( isa )
+	{
+	  case SCALAR:	return true;
+	  case SSE2:	return __builtin_cpu_supports( "sse2" );
+	  case AVX2:	return __builtin_cpu_supports( "avx2" );
+	  case AVX512:	return __builtin_cpu_supports( "avx512f" );
+	  default:		return false;
+	}
+#else
+	return isa == SCALAR;
+#endif
+}
+
+
+const char *VectorKernels::getISAName( ISA isa )
+{
+	static const char *names[] = { "scalar", "SSE2", "AVX2", "AVX-512", "none" };
+	return names[isa];
+}
+
+
+bool VectorKernels::setISA( ISA isa )
+{
+	if ( isa >= NUM_ISAS  ||  !isSupported( isa ) )
+	{
+		return false;
+	}
+
+	_kernels = KernelTable[isa];
+	_isa = isa;
+	return true;
+}
+
+
+VectorKernels::ISA VectorKernels::getISA()
+{
+	if ( _isa == NUM_ISAS )
+	{
+		int isa = AVX512;
+
+		while ( !isSupported( (ISA)isa ) ) --isa;
+		setISA( (ISA)isa );
+		Util::log( INFO, string("[VectorKernels::getISA()] Using the ") + getISAName( _isa ) + " kernels." );
+	}
+	return _isa;
+}
@@ -0,0 +1,100 @@
+/*
+ * VectorKernels.h
+ *  The inner loops over samples and means, vectorised for the instruction
+ *  sets of the machine we run on, picked at run time.
+ *  Created on: 3 Mar 2014
+ *      Author: jeevw
+ */
+
+#ifndef _NEUROTRADE_VECTORKERNELS_H_
+#define _NEUROTRADE_VECTORKERNELS_H_
+
+#include <stddef.h>
+
+
+class VectorKernels
+{
+  public:
+
+	enum ISA { SCALAR, SSE2, AVX2, AVX512, NUM_ISAS };
+
+	/* The window lengths with kernels of their own, unrolled for them; those
+	 * over a window pick them by n at each call. Any other n takes the general
+	 * kernels, of the same results.
+	 */
+	enum Window { ANY_WINDOW, WINDOW_16, WINDOW_32, WINDOW_64, WINDOW_80, WINDOW_128, NUM_WINDOWS };
+
+	static Window getWindow( unsigned int n )
+		{
+			switch ( n )
+			{
+			  case 16:	return WINDOW_16;
+			  case 32:	return WINDOW_32;
+			  case 64:	return WINDOW_64;
+			  case 80:	return WINDOW_80;
+			  case 128:	return WINDOW_128;
+			  default:	return ANY_WINDOW;
+			}
+		}
+
+	struct Kernels
+	{
+		float (*squaredDistance)( const float *, const float *, unsigned int );
+		float (*dot)( const float *, const float *, unsigned int );
+		void  (*dotProducts)( const float *const *, unsigned int, const float *, unsigned int, unsigned int,
+							  unsigned int, float *, unsigned int );
+		void  (*mexicanHat)( float *, unsigned int, float, float );
+	};
+
+	/* Sum of ( a[i] - b[i] )^2 over n floats.
+	 * Every instruction set adds the same terms in the same order: 16 running
+	 * partial sums, reduced pairwise, then the tail of fewer than 16 terms.
+	 * So the result is the same to the bit whichever kernel runs.
+	 */
+	static float squaredDistance( const float *a, const float *b, unsigned int n )
+		{ return kernels( n )->squaredDistance( a, b, n ); }
+
+	// Sum of a[i] * b[i], added up in the same order as squaredDistance().
+	static float dot( const float *a, const float *b, unsigned int n )
+		{ return kernels( n )->dot( a, b, n ); }
+
+	/* out[ i * ldo + j ] = rows[i] . centres[ j * ldc ], over n floats, for numRows
+	 * rows and numCentres centres. Blocked over rows and centres so that each load
+	 * serves several products; every product is the same sum as dot().
+	 */
+	static void dotProducts( const float *const *rows, unsigned int numRows,
+							 const float *centres, unsigned int numCentres, unsigned int ldc,
+							 unsigned int n, float *out, unsigned int ldo )
+		{ kernels( n )->dotProducts( rows, numRows, centres, numCentres, ldc, n, out, ldo ); }
+
+	/* The Mexican hat wavelet of n squared distances, in place:
+	 *     t[i] = A ( 1 - t[i] r_2 ) exp( -t[i] r_2 / 2 )
+	 * with a polynomial exp() that every kernel evaluates in the same steps.
+	 */
+	static void mexicanHat( float *t, unsigned int n, float A, float r_2 )
+		{ kernels( 0 )->mexicanHat( t, n, A, r_2 ); }
+
+	// The best the CPU supports, unless set otherwise.
+	static ISA getISA();
+	static const char *getISAName( ISA isa );
+
+	// For benchmarks and checks; false if the CPU cannot run it.
+	static bool setISA( ISA isa );
+	static bool isSupported( ISA isa );
+
+
+  private:
+
+	static const Kernels *_kernels;		// NUM_WINDOWS of them, NULL until picked
+	static ISA _isa;
+
+	// those for a window of n
+	static const Kernels *kernels( unsigned int n )
+		{
+			if ( !_kernels ) getISA();
+			return _kernels + getWindow( n );
+		}
+
+};
+
+#endif /* _NEUROTRADE_VECTORKERNELS_H_ */
@@ -0,0 +1,166 @@
+/*
+ * WalkForward.cpp
+ *
+ *  Created on: 19 Mar 2014
+ *      Author: jeevw
+ */
+
+#include <stdexcept>
+
+#include "WalkForward.h"
+#include "ThreadPool.h"
+
+
+
+WalkForward::WalkForward( const SampleStore &store, unsigned long trainBars, unsigned long testBars,
+						  unsigned long stepBars )
+	: _store( store ), _trainBars( trainBars ), _testBars( testBars ), _stepBars( stepBars ? stepBars : testBars ),
+	  _k( 0 ), _rFactor( Param::Radius_Factor ), _method( KMeansClustering::BISECTING ),
+	  _seeding( KMeansClustering::UNIFORM ), _cutoff( Param::Wavelet_Cutoff )
+{
+	const unsigned long numReturns = store.getNumReturns(), length = store.getWindowLength();
+	const unsigned long n = Param::InputSampleSize;
+	Fold f;
+
+	if ( _testBars == 0  ||  _trainBars <= n )
+	{
+		throw invalid_argument("[WalkForward::WalkForward()] A fold must train on a window and test on a return.");
+	}
+
+	/* The target of window i is return i + n, Param::InputSampleSize on; the
+	 * returns of a window past its target, if it predicts more than one bar,
+	 * are not used. The last test window must fit in the store.
+	 */
+	for ( f.trainBegin = 0; f.trainBegin + _trainBars + _testBars - n - 1 + length <= numReturns;
+		  f.trainBegin += _stepBars )
+	{
+		f.testBegin = f.trainBegin + _trainBars;
+		f.testEnd = f.testBegin + _testBars;
+		f.numTrain = f.testBegin - f.trainBegin - n;
+		f.numTest = _testBars;
+		f.clusterTime = f.trainTime = f.testTime = 0;
+		f.error.directional_err = f.error.mean_sqr_err = f.error.mean_fractional_error = 0;
+		_folds.push_back( f );
+	}
+}
+
+
+void WalkForward::setNetwork( unsigned int k, float rFactor, KMeansClustering::Method method,
+							  KMeansClustering::Seeding seeding, float cutoff )
+{
+	_k = k;
+	_rFactor = rFactor;
+	_method = method;
+	_seeding = seeding;
+	_cutoff = cutoff;
+}
+
+
+void WalkForward::runFold( Fold &f ) const
+{
+	const unsigned long n = Param::InputSampleSize;
+	WaveletNN nn;
+	double t0;
+
+	// the windows are views of the store: a fold copies no returns
+	nn.setSamples( _store, f.trainBegin, f.trainBegin + f.numTrain );
+	nn.setTestData( _store, f.testBegin - n, f.testEnd - n );
+	nn.setCutoff( _cutoff );
+
+	t0 = Util::getTime();
+	nn.setWaveletMeansAndRadius( _k, _rFactor, _method, _seeding );
+	f.clusterTime = Util::getTime() - t0;
+
+	t0 = Util::getTime();
+	nn.trainWeights();
+	f.trainTime = Util::getTime() - t0;
+
+	t0 = Util::getTime();
+	f.error = nn.test();
+	f.testTime = Util::getTime() - t0;
+}
+
+
+// One fold; the nested parallel stages of its network run in its own thread.
+class WalkForward::FoldTask: public ThreadTask
+{
+  public:
+
+	FoldTask( const WalkForward &wf, Fold &f ) : _wf(wf), _f(f) {}
+
+	void run()
+	{
+		// a fold that cannot be trained, with too few distinct windows say, does not stop the others
+		try
+		{
+			_wf.runFold( _f );
+		}
+		catch ( exception &e )
+		{
+			_f.failure = e.what();
+		}
+	}
+
+
+  private:
+
+	const WalkForward	&_wf;
+	Fold				&_f;
+
+};
+
+
+const vector<WalkForward::Fold> &WalkForward::run()
+{
+	vector<FoldTask> foldTasks;
+	vector<ThreadTask *> tasks;
+	double t0 = Util::getTime(), hits = 0;
+	unsigned long tests = 0;
+	unsigned int i;
+
+	if ( _folds.empty() )
+	{
+		Util::log( ERROR, "[WalkForward::run()] The series is too short for a fold." );
+		return _folds;
+	}
+	Util::log( INFO, string("[WalkForward::run()] ") + Util::itoa( _folds.size() ) + " folds of "
+					 + Util::itoa( _trainBars ) + " returns to train on and " + Util::itoa( _testBars )
+					 + " to test on, " + Util::itoa( _stepBars ) + " apart, on "
+					 + Util::itoa( ThreadPool::getDefault().getNumThreads() ) + " threads." );
+
+	foldTasks.reserve( _folds.size() );
+	for ( i = 0; i < _folds.size(); ++i )
+	{
+		foldTasks.push_back( FoldTask( *this, _folds[i] ) );
+	}
+	for ( i = 0; i < _folds.size(); ++i )
+	{
+		tasks.push_back( &foldTasks[i] );
+	}
+	ThreadPool::getDefault().run( tasks );
+
+	for ( i = 0; i < _folds.size(); ++i )
+	{
+		const Fold &f = _folds[i];
+		string fold = string("[WalkForward::run()] Fold ") + Util::itoa( i + 1 ) + ", train ["
+					  + Util::itoa( f.trainBegin ) + ", " + Util::itoa( f.testBegin ) + "), test ["
+					  + Util::itoa( f.testBegin ) + ", " + Util::itoa( f.testEnd ) + "): ";
+
+		if ( !f.failure.empty() )
+		{
+			Util::log( ERROR, fold + f.failure );
+			continue;
+		}
+		Util::log( INFO, fold + "clustered in " + Util::ftoa( f.clusterTime ) + " s, trained in "
+						 + Util::ftoa( f.trainTime ) + " s, tested in " + Util::ftoa( f.testTime )
+						 + " s; directional accuracy " + Util::ftoa( 100 - f.error.directional_err ) + "%." );
+		hits += ( 100 - f.error.directional_err ) / 100 * f.numTest;
+		tests += f.numTest;
+	}
+
+	Util::log( INFO, string("[WalkForward::run()] Directional accuracy over ") + Util::itoa( tests )
+					 + " out of time tests: " + Util::ftoa( tests > 0 ? 100 * hits / tests : 0 ) + "%, in "
+					 + Util::ftoa( Util::getTime() - t0 ) + " s." );
+
+	return _folds;
+}
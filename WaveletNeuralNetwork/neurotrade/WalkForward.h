@@ -0,0 +1,89 @@
+/*
+ * WalkForward.h
+ *  Out of time testing of the network: each fold trains on a run of bars and
+ *  tests on the bars right after it, then the folds step forward along the
+ *  series. The folds run in parallel, over views of the one store.
+ *  Created on: 19 Mar 2014
+ *      Author: jeevw
+ */
+
+#ifndef _NEUROTRADE_WALKFORWARD_H_
+#define _NEUROTRADE_WALKFORWARD_H_
+
+#include <string>
+#include <vector>
+
+#include "def.h"
+#include "SampleStore.h"
+#include "KMeansClustering.h"
+#include "WaveletNN.h"
+
+
+using namespace std;
+
+
+class WalkForward
+{
+  public:
+
+	struct Fold
+	{
+		unsigned long		trainBegin;		// the returns it trains on, [trainBegin, testBegin)
+		unsigned long		testBegin;		// and whose targets it tests, [testBegin, testEnd)
+		unsigned long		testEnd;
+		unsigned long		numTrain;		// windows
+		unsigned long		numTest;
+		double				clusterTime;	// s
+		double				trainTime;
+		double				testTime;
+		WaveletNN::Error	error;
+		string				failure;		// why it did not run; empty if it did
+	};
+
+	/* Folds of trainBars returns to train on and the testBars after them to
+	 * test on, stepBars apart along the store; 0 for a step of testBars. A
+	 * training window is one whose sample and target are among its fold's
+	 * training returns, and a test window one whose target is among the test
+	 * returns, so no fold is trained on a return it is tested on. The target
+	 * is the return Param::InputSampleSize on from a window's first, however
+	 * many bars it predicts. The store must outlive it.
+	 */
+	WalkForward( const SampleStore &store, unsigned long trainBars = Param::WalkForward_Train_Bars,
+				 unsigned long testBars = Param::WalkForward_Test_Bars, unsigned long stepBars = 0 );
+
+	// The network each fold trains, as for WaveletNN::setWaveletMeansAndRadius().
+	void setNetwork( unsigned int k, float rFactor,
+					 KMeansClustering::Method method = KMeansClustering::BISECTING,
+					 KMeansClustering::Seeding seeding = KMeansClustering::UNIFORM,
+					 float cutoff = Param::Wavelet_Cutoff );
+
+	unsigned int getNumFolds() const { return _folds.size(); }
+
+	/* Runs the folds, a fold to a thread of the default pool, and logs each
+	 * fold's times and directional accuracy, and that over all their tests.
+	 */
+	const vector<Fold> &run();
+
+	const vector<Fold> &getFolds() const { return _folds; }
+
+
+  private:
+
+	const SampleStore	&_store;
+	unsigned long		_trainBars, _testBars, _stepBars;
+
+	unsigned int				_k;
+	float						_rFactor;
+	KMeansClustering::Method	_method;
+	KMeansClustering::Seeding	_seeding;
+	float						_cutoff;
+
+	vector<Fold>	_folds;
+
+	class FoldTask;
+
+	void runFold( Fold &f ) const;
+
+};
+
+#endif /* _NEUROTRADE_WALKFORWARD_H_ */
@@ -6,12 +6,66 @@
  */
 
 #include "WaveletNN.h"
+#include "VectorKernels.h"
+#include "ThreadPool.h"
+#include "NormalEquations.h"
 #include <float.h>
 #include <math.h>
 #include <stdexcept>
+#include <algorithm>
 #include <set>
 
 
+// Rows of the hidden layer per block: their samples and the means stay in cache.
+static const unsigned int HiddenBlockRows = 256;
+
+/* The samples are split into this many chunks for the Gram matrix, whatever the
+ * number of threads, and the chunks' sums added up in order; so the weights do
+ * not depend on the machine.
+ */
+static const unsigned int GramChunks = 128;
+
+/* The widest span of returns whose running sum of squares gives a block's
+ * sample norms: past about one return in 16 of the block's samples' terms,
+ * the vector kernels' dot products are as cheap. The sums are on the stack,
+ * so this is for windows of up to 128 returns; longer ones do without.
+ */
+static const unsigned int SlidingMaxSpan = HiddenBlockRows * 128 / 16;
+
+
+
+void WaveletNN::setSamples( const SampleStore &store )
+{
+	setSamples( store, 0, store.getNumWindows() );
+}
+
+
+void WaveletNN::setSamples( const SampleStore &store, unsigned long begin, unsigned long end )
+{
+	end = min( end, store.getNumWindows() );
+
+	_samples.clear();
+	_samples.reserve( end > begin ? end - begin : 0 );
+	for ( unsigned long i = begin; i < end; ++i )
+	{
+		_samples.push_back( store.getWindow(i) );
+	}
+}
+
+
+void WaveletNN::setTestData( const SampleStore &store, unsigned long begin, unsigned long end )
+{
+	end = min( end, store.getNumWindows() );
+
+	_testData.clear();
+	_testData.reserve( end > begin ? end - begin : 0 );
+	for ( unsigned long i = begin; i < end; ++i )
+	{
+		_testData.push_back( store.getWindow(i) );
+	}
+	_fixedTestData = true;
+}
+
 
 void WaveletNN::initClustersTestData( KMeansClustering &kMeansClusters, bool useAllTrainingData )
 {
@@ -27,6 +81,7 @@ void WaveletNN::initClustersTestData( KMeansClustering &kMeansClusters, bool use
 	}
 	else // separate 5% as test data
 	{
+		cluster.reserve( _samples.size() );
 		for ( unsigned int i = 0; i < _samples.size(); ++i )
 		{
 			if ( i%10 == 0 )
@@ -60,10 +115,15 @@ void WaveletNN::initClustersTestData( KMeansClustering &kMeansClusters, bool use
 
 
 
-float WaveletNN::mexicanHatWavelet( vector<float> sample, vector<float> mean, float radius )
+float WaveletNN::waveletScale( float radius )
+{
+	return 2 / ( pow( M_PI, 0.25) * sqrt(3) * sqrt(radius) );
+}
+
+
+float WaveletNN::mexicanHatWavelet( const SampleView &sample, const vector<float> &mean, float radius )
 {
-	float A, T2 = 0, r_2, t;
-	//vector<float> t( Param::InputSampleSize, 0.0 );
+	float r_2, t;
 
 	if ( radius == 0 )
 	{
@@ -72,33 +132,68 @@ float WaveletNN::mexicanHatWavelet( vector<float> sample, vector<float> mean, fl
 
 	r_2 = 1/( radius * radius);
 
-	A = 2 / ( pow( M_PI, 0.25) * sqrt(3) * sqrt(radius) );
-
-	for ( unsigned int i=0; i < Param::InputSampleSize; ++i )
-	{
-		T2 += (sample[i] - mean[i]) * (sample[i] - mean[i]);
-	}
+	t = VectorKernels::squaredDistance( sample.data(), &mean[0], Param::InputSampleSize );
 
-	t = A * ( 1 - T2 * r_2 ) * exp( -T2 * r_2 / 2 );
+	// the same activation as the hidden layer
+	VectorKernels::mexicanHat( &t, 1, waveletScale( radius ), r_2 );
 
 	return t;
 }
 
 
-void WaveletNN::setWaveletMeansAndRadius( unsigned int k, float rFactor )
+void WaveletNN::setWaveletMeansAndRadius( unsigned int k, float rFactor, KMeansClustering::Method method,
+										  KMeansClustering::Seeding seeding )
 {
 	unsigned int K, m;
+	unsigned long long key;
 	KMeansClustering kMeansClustering;
 
 	Util::log( INFO, "[WaveletNN::setWaveletMeansAndRadius()] Preparing clusters and test data.");
-	initClustersTestData( kMeansClustering, false );
+	initClustersTestData( kMeansClustering, _fixedTestData );
 
 	K = ( k == 0) ? 0.60 * Param::InputSampleSize : k;
 	Util::log( INFO, string("[WaveletNN::setWaveletMeansAndRadius()] Training for K = ")
 					 + Util::itoa(K) + " means." );
 
-	kMeansClustering.bisectingKMeansClustering( K );
-	Util::log( INFO, "[WaveletNN::setWaveletMeansAndRadius()] Bisection K-Means Clustering completed. ");
+	kMeansClustering.setSeeding( seeding );
+	key = ( method == KMeansClustering::BISECTING ) ? kMeansClustering.getTreeKey() : 0;
+	if ( method == KMeansClustering::BISECTING  &&  _tree.getMaxK() >= K  &&  _treeKey == key )
+	{
+		kMeansClustering.getTree() = _tree;
+		kMeansClustering.cutTree( K );
+	}
+	else if ( method == KMeansClustering::BISECTING )
+	{
+		/* bisect as far as asked, and cut the tree for this K; a tree of seeds
+		 * from the clock is not kept, as the next run would draw others
+		 */
+		BisectionTree &tree = kMeansClustering.getTree();
+		bool keep = !_treePath.empty()  &&  kMeansClustering.getSeed() != 0;
+
+		if ( keep  &&  tree.load( _treePath, key )  &&  tree.getMaxK() >= K )
+		{
+			Util::log( INFO, "[WaveletNN::setWaveletMeansAndRadius()] Loaded the bisection tree: " + _treePath );
+		}
+		else
+		{
+			kMeansClustering.bisectingKMeansClustering( max( K, _treeMaxK ) );
+			if ( keep )
+			{
+				tree.save( _treePath, key );
+			}
+		}
+		kMeansClustering.cutTree( K );
+	}
+	else
+	{
+		kMeansClustering.cluster( K, method );
+	}
+	if ( method == KMeansClustering::BISECTING )
+	{
+		_tree = kMeansClustering.getTree();
+		_treeKey = key;
+	}
+	Util::log( INFO, "[WaveletNN::setWaveletMeansAndRadius()] K-Means Clustering completed. ");
 
 	cout<< "\nCLUSTER SIZES: "<< endl;
 	for ( unsigned int i = 0; i < kMeansClustering.getNumClusters(); ++i )
@@ -108,6 +203,8 @@ void WaveletNN::setWaveletMeansAndRadius( unsigned int k, float rFactor )
 	}
 	cout<< endl;
 
+	_kMeans.clear();
+	clearDistances();
 	m = kMeansClustering.getKMeans( _kMeans );
 	Util::log( INFO, string("[WaveletNN::setWaveletMeansAndRadius()] Set ")
 								+ Util::itoa(m) + " means." );
@@ -145,7 +242,8 @@ void WaveletNN::setWaveletMeansAndRadius( unsigned int k, float rFactor )
 		_radius += dist;
 		dist = FLT_MAX;
 	}
-	_radius = rFactor *  _radius / ( _kMeans.size() -1);
+	_meanNearest = _radius / ( _kMeans.size() -1);
+	setRadiusFactor( rFactor );
 
 	Util::log( INFO, string("[WaveletNN::setWaveletMeansAndRadius()] Wavelet radius with the mean: ")
 			+ Util::ftoa( _radius ) );
@@ -178,41 +276,549 @@ void WaveletNN::setWaveletMeansAndRadius( unsigned int k, float rFactor )
 
 
 
+void WaveletNN::setCentres()
+{
+	unsigned int K = _kMeans.size(), ldc = AlignedArray::stride( Param::InputSampleSize );
+	float *c;
+
+	if ( _radius == 0 )
+	{
+		throw invalid_argument("[WaveletNN::setCentres()] error: zero radius" );
+	}
+
+	_centres.resize( (unsigned long)K * ldc );
+	_centreNorms.resize( K );
+	for ( unsigned int j = 0; j < K; ++j )
+	{
+		c = _centres.data() + (unsigned long)j * ldc;
+		copy( _kMeans[j].begin(), _kMeans[j].begin() + Param::InputSampleSize, c );
+		_centreNorms[j] = VectorKernels::dot( c, c, Param::InputSampleSize );
+	}
+
+	_scale = waveletScale( _radius );
+	_r_2 = 1 / ( _radius * _radius );
+
+	_centreTree.clear();
+	if ( _cutoff > 0 )
+	{
+		_centreTree.build( _centres.data(), K, ldc, Param::InputSampleSize );
+	}
+}
+
+
+void WaveletNN::setCutoff( float c )
+{
+	_cutoff = max( c, 0.0f );
+	if ( !_kMeans.empty()  &&  _radius > 0 )
+	{
+		setCentres();
+	}
+}
+
+
+float WaveletNN::cutoffBound( float c )
+{
+	double u = c * c, b;
+
+	// ( 1 - u ) exp( -u / 2 ) is least at u = 3, and falls off in size past it
+	b = ( u < 3 ) ? 2 * exp( -1.5 ) : ( u - 1 ) * exp( -u / 2 );
+	if ( u < 1 )
+	{
+		b = max( b, ( 1 - u ) * exp( -u / 2 ) );
+	}
+	return b;
+}
+
+
+void WaveletNN::setRadiusFactor( float f )
+{
+	_radius = f * _meanNearest;
+	setCentres();
+}
+
+
+// The squared distances of a set of samples to the means, a row of K for each.
+class WaveletNN::DistanceTask : public RangeTask
+{
+  public:
+
+	DistanceTask( const WaveletNN &nn, const vector<SampleView> &samples, float *d )
+		: _nn(nn), _samples(samples), _d(d)
+	{}
+
+	void run( unsigned long begin, unsigned long end, unsigned int )
+		{
+			unsigned int K = _nn._kMeans.size();
+
+			_nn.squaredDistances( _samples, begin, end, _d + begin * K, K );
+		}
+
+  private:
+
+	const WaveletNN				&_nn;
+	const vector<SampleView>	&_samples;
+	float						*_d;
+};
+
+
+void WaveletNN::cacheDistances()
+{
+	const unsigned int K = _kMeans.size();
+	double t0 = Util::getTime();
+
+	_trainDistances.resize( (unsigned long)_samples.size() * K );
+	_testDistances.resize( (unsigned long)_testData.size() * K );
+
+	DistanceTask train( *this, _samples, _trainDistances.data() );
+	ThreadPool::getDefault().parallelFor( _samples.size(), train );
+	DistanceTask test( *this, _testData, _testDistances.data() );
+	ThreadPool::getDefault().parallelFor( _testData.size(), test );
+
+	Util::log( INFO, string("[WaveletNN::cacheDistances()] Squared distances of ")
+					 + Util::itoa( _samples.size() + _testData.size() ) + " samples to "
+					 + Util::itoa( K ) + " means set in " + Util::ftoa( Util::getTime() - t0 ) + " s." );
+}
+
+
+void WaveletNN::clearDistances()
+{
+	_trainDistances.resize( 0 );
+	_testDistances.resize( 0 );
+}
+
+
+vector<WaveletNN::Error> WaveletNN::sweepRadiusFactors( const vector<float> &factors )
+{
+	vector<Error> errors;
+	unsigned int best = 0;
+	double t0;
+
+	if ( factors.empty() )
+	{
+		return errors;
+	}
+	if ( _trainDistances.size() == 0 )
+	{
+		cacheDistances();
+	}
+
+	for ( unsigned int f = 0; f < factors.size(); ++f )
+	{
+		t0 = Util::getTime();
+		setRadiusFactor( factors[f] );
+		trainWeights();
+		errors.push_back( test() );
+		if ( errors[f].directional_err < errors[best].directional_err )
+		{
+			best = f;
+		}
+		Util::log( INFO, string("[WaveletNN::sweepRadiusFactors()] RFactor ") + Util::ftoa( factors[f] )
+						 + ", radius " + Util::ftoa( _radius ) + ": directional accuracy "
+						 + Util::ftoa( 100 - errors[f].directional_err ) + "% in "
+						 + Util::ftoa( Util::getTime() - t0 ) + " s." );
+	}
+
+	Util::log( INFO, string("[WaveletNN::sweepRadiusFactors()] Best RFactor ") + Util::ftoa( factors[best] )
+					 + " with directional accuracy " + Util::ftoa( 100 - errors[best].directional_err ) + "%." );
+	if ( best != factors.size() - 1 )
+	{
+		setRadiusFactor( factors[best] );
+		trainWeights();
+	}
+
+	return errors;
+}
+
+
+/* The squared norms of samples [b, b + m) from a running sum of squares over
+ * the returns they span, if they are windows of one store in increasing order
+ * close enough together; else false. Consecutive windows differ by a return in
+ * and a return out, so each norm is then a difference of two sums, O(1) for
+ * a sample rather than O(n). The sum is in double and starts again from every
+ * block, so the norms do not drift along the series.
+ */
+static bool slidingNorms( const vector<SampleView> &samples, unsigned long b, unsigned long m, unsigned int n,
+						  float *norms )
+{
+	double sums[ SlidingMaxSpan + 1 ], s = 0;
+	const float *x = samples[b].data();
+	unsigned long i, o, span;
+
+	for ( i = 1; i < m; ++i )
+	{
+		if ( samples[b+i].getStore() != samples[b].getStore()
+			 ||  samples[b+i].getOffset() <= samples[b+i-1].getOffset() )
+		{
+			return false;
+		}
+	}
+	span = samples[b+m-1].getOffset() - samples[b].getOffset() + n;
+	if ( span > SlidingMaxSpan  ||  span * 16 > m * n )
+	{
+		return false;
+	}
+
+	sums[0] = 0;
+	for ( o = 0; o < span; ++o )
+	{
+		s += (double)x[o] * x[o];
+		sums[o+1] = s;
+	}
+	for ( i = 0; i < m; ++i )
+	{
+		o = samples[b+i].getOffset() - samples[b].getOffset();
+		norms[i] = sums[o+n] - sums[o];
+	}
+	return true;
+}
+
+
+void WaveletNN::squaredDistances( const vector<SampleView> &samples, unsigned long begin, unsigned long end,
+								  float *d, unsigned int ldd ) const
+{
+	const unsigned int K = _kMeans.size(), n = Param::InputSampleSize;
+	const float *rows[HiddenBlockRows];
+	float norms[HiddenBlockRows], *di, t;
+	unsigned long b, m, i;
+	unsigned int j;
+
+	for ( b = begin; b < end; b += m )
+	{
+		m = min( end - b, (unsigned long)HiddenBlockRows );
+		di = d + ( b - begin ) * ldd;
+
+		for ( i = 0; i < m; ++i )
+		{
+			rows[i] = samples[b+i].data();
+		}
+		if ( !slidingNorms( samples, b, m, n, norms ) )
+		{
+			for ( i = 0; i < m; ++i )
+			{
+				norms[i] = VectorKernels::dot( rows[i], rows[i], n );
+			}
+		}
+
+		VectorKernels::dotProducts( rows, m, _centres.data(), K, AlignedArray::stride( n ), n, di, ldd );
+
+		for ( i = 0; i < m; ++i, di += ldd )
+		{
+			for ( j = 0; j < K; ++j )
+			{
+				// the identity cancels for samples near a mean, and may go just below zero
+				t = norms[i] + _centreNorms[j] - 2 * di[j];
+				di[j] = ( t > 0 ) ? t : 0;
+			}
+		}
+	}
+}
+
+
+void WaveletNN::hiddenLayer( const vector<SampleView> &samples, unsigned long begin, unsigned long end,
+							 float *h, unsigned int ldh ) const
+{
+	const unsigned int K = _kMeans.size();
+
+	squaredDistances( samples, begin, end, h + 1, ldh );
+	for ( unsigned long i = begin; i < end; ++i, h += ldh )
+	{
+		h[0] = 1.0;
+		VectorKernels::mexicanHat( h + 1, K, _scale, _r_2 );
+	}
+}
+
+
+void WaveletNN::hiddenLayer( const float *d, unsigned long numRows, float *h, unsigned int ldh ) const
+{
+	const unsigned int K = _kMeans.size();
+
+	for ( unsigned long i = 0; i < numRows; ++i, d += K, h += ldh )
+	{
+		h[0] = 1.0;
+		copy( d, d + K, h + 1 );
+		VectorKernels::mexicanHat( h + 1, K, _scale, _r_2 );
+	}
+}
+
+
+// Appends a row of the sparse hidden layer: 1, then the wavelets of the means near the sample.
+void WaveletNN::appendSparseRow( vector< pair<unsigned int, float> > &near, SparseRows &h ) const
+{
+	unsigned long first = h.value.size() + 1;
+
+	sort( near.begin(), near.end() );
+	h.column.push_back( 0 );
+	h.value.push_back( 1.0 );
+	for ( unsigned int c = 0; c < near.size(); ++c )
+	{
+		h.column.push_back( near[c].first + 1 );
+		h.value.push_back( near[c].second );
+	}
+	if ( !near.empty() )
+	{
+		VectorKernels::mexicanHat( &h.value[first], near.size(), _scale, _r_2 );
+	}
+	h.start.push_back( h.value.size() );
+}
+
+
+unsigned long WaveletNN::sparseHiddenLayer( const vector<SampleView> &samples, unsigned long begin, unsigned long end,
+											SparseRows &h ) const
+{
+	vector< pair<unsigned int, float> > near;
+	vector<unsigned int> index;
+	vector<float> d2;
+	unsigned long measured = 0;
+
+	for ( unsigned long i = begin; i < end; ++i )
+	{
+		index.clear();
+		d2.clear();
+		measured += _centreTree.within( samples[i].data(), _cutoff * _radius, index, d2 );
+
+		near.clear();
+		for ( unsigned int c = 0; c < index.size(); ++c )
+		{
+			near.push_back( make_pair( index[c], d2[c] ) );
+		}
+		appendSparseRow( near, h );
+	}
+	return measured;
+}
+
+
+unsigned long WaveletNN::sparseHiddenLayer( const float *d, unsigned long numRows, SparseRows &h ) const
+{
+	const unsigned int K = _kMeans.size();
+	const float reach = ( _cutoff * _radius ) * ( _cutoff * _radius );
+	vector< pair<unsigned int, float> > near;
+
+	for ( unsigned long i = 0; i < numRows; ++i, d += K )
+	{
+		near.clear();
+		for ( unsigned int j = 0; j < K; ++j )
+		{
+			if ( d[j] <= reach )
+			{
+				near.push_back( make_pair( j, d[j] ) );
+			}
+		}
+		appendSparseRow( near, h );
+	}
+	return 0;
+}
+
+
+class WaveletNN::HiddenLayerTask : public RangeTask
+{
+  public:
+
+	HiddenLayerTask( const WaveletNN &nn, const vector<SampleView> &samples, float *h, unsigned int ldh )
+		: _nn(nn), _samples(samples), _h(h), _ldh(ldh)
+	{}
+
+	void run( unsigned long begin, unsigned long end, unsigned int )
+		{ _nn.hiddenLayer( _samples, begin, end, _h + begin * _ldh, _ldh ); }
+
+  private:
+
+	const WaveletNN				&_nn;
+	const vector<SampleView>	&_samples;
+	float						*_h;
+	unsigned int				_ldh;
+};
+
+
+void WaveletNN::hiddenLayer( const vector<SampleView> &samples, float *h, unsigned int ldh ) const
+{
+	HiddenLayerTask task( *this, samples, h, ldh );
+
+	ThreadPool::getDefault().parallelFor( samples.size(), task );
+}
+
+
+class WaveletNN::GramTask : public RangeTask
+{
+  public:
+
+	GramTask( const WaveletNN &nn, unsigned int numChunks )
+		: measured( numChunks, 0 ), kept( numChunks, 0 ),
+		  _nn(nn), _partials( numChunks, NormalEquations( nn._kMeans.size() + 1 ) )
+	{}
+
+	// a block of the hidden layer at a time into the chunk's own Gram matrix
+	void run( unsigned long begin, unsigned long end, unsigned int chunk )
+		{
+			unsigned int ldh = _nn._kMeans.size() + 1;
+			AlignedArray H( (unsigned long)HiddenBlockRows * ldh );
+			float Y[HiddenBlockRows];
+			unsigned long b, m, i;
+
+			if ( _nn._cutoff > 0 )
+			{
+				runSparse( begin, end, chunk );
+				return;
+			}
+			for ( b = begin; b < end; b += m )
+			{
+				m = min( end - b, (unsigned long)HiddenBlockRows );
+				if ( _nn._trainDistances.size() > 0 )
+				{
+					_nn.hiddenLayer( _nn._trainDistances.data() + b * ( ldh - 1 ), m, H.data(), ldh );
+				}
+				else
+				{
+					_nn.hiddenLayer( _nn._samples, b, b + m, H.data(), ldh );
+				}
+				for ( i = 0; i < m; ++i )
+				{
+					Y[i] = _nn._samples[b+i][Param::InputSampleSize];
+				}
+				_partials[chunk].addRows( H.data(), ldh, Y, m );
+			}
+		}
+
+	// the same from sparse rows, of the means within the cutoff only
+	void runSparse( unsigned long begin, unsigned long end, unsigned int chunk )
+		{
+			unsigned int K = _nn._kMeans.size();
+			SparseRows S;
+			unsigned long b, m, i;
+
+			for ( b = begin; b < end; b += m )
+			{
+				m = min( end - b, (unsigned long)HiddenBlockRows );
+				S.clear();
+				if ( _nn._trainDistances.size() > 0 )
+				{
+					_nn.sparseHiddenLayer( _nn._trainDistances.data() + b * K, m, S );
+				}
+				else
+				{
+					measured[chunk] += _nn.sparseHiddenLayer( _nn._samples, b, b + m, S );
+				}
+				for ( i = 0; i < m; ++i )
+				{
+					_partials[chunk].addRow( &S.column[ S.start[i] ], &S.value[ S.start[i] ],
+											 S.start[i+1] - S.start[i], _nn._samples[b+i][Param::InputSampleSize] );
+				}
+				kept[chunk] += S.value.size() - m;		// less the constant terms
+			}
+		}
+
+	void reduce( NormalEquations &normal ) const
+		{
+			for ( unsigned int c = 0; c < _partials.size(); ++c )
+			{
+				normal.add( _partials[c] );
+			}
+		}
+
+	vector<unsigned long>	measured, kept;		// distances and activations, per chunk
+
+  private:
+
+	const WaveletNN				&_nn;
+	vector<NormalEquations>		_partials;
+};
+
+
 void WaveletNN::trainWeights()
 {
-	unsigned int i, j;
+	unsigned int ldh = _kMeans.size() + 1, numChunks;
+	unsigned long i;
+	NormalEquations normal( ldh );
+	NormalEquations::Method method;
+	vector<double> w;
+	double t0 = Util::getTime();
+
+	numChunks = min( (unsigned long)GramChunks, (unsigned long)_samples.size() );
+	if ( numChunks > 0 )
+	{
+		GramTask task( *this, numChunks );
+
+		ThreadPool::getDefault().parallelFor( _samples.size(), task, numChunks );
+		task.reduce( normal );
+
+		if ( _cutoff > 0 )
+		{
+			unsigned long measured = 0, kept = 0, all = (unsigned long)_samples.size() * _kMeans.size();
+
+			for ( unsigned int c = 0; c < numChunks; ++c )
+			{
+				measured += task.measured[c];
+				kept += task.kept[c];
+			}
+			Util::log( INFO, string("[WaveletNN::trainWeights()] Cutoff at ") + Util::ftoa( _cutoff )
+							 + " radii kept " + Util::ftoa( 100.0 * kept / all ) + "% of the activations, from "
+							 + ( _trainDistances.size() > 0 ? string("the cached distances.")
+									 : Util::ftoa( 100.0 * measured / all ) + "% of the distances." ) );
+		}
+	}
+
+	Util::log( INFO, string("[WaveletNN::trainWeights()] Gram matrix of ")
+					 + Util::itoa( normal.getNumRows() ) + " samples set in "
+					 + Util::ftoa( Util::getTime() - t0 ) + " s on "
+					 + Util::itoa( ThreadPool::getDefault().getNumThreads() ) + " threads.");
+
+	method = normal.solve( w );
+	if ( method == NormalEquations::NONE )
+	{
+		throw domain_error("[WaveletNN::trainWeights()] No samples to train on.");
+	}
+	_normal = normal;
+
+	_weights = leda::vector( ldh );
+	for ( i = 0; i < ldh; ++i )
+	{
+		_weights[i] = w[i];
+	}
+
+	Util::log( INFO, string("[WaveletNN::trainWeights()] Weights trained by ")
+					 + NormalEquations::getMethodName( method ) + "." );
+
+	cout<< "Weights : "<< endl;
+	_weights.print();
+
+}
+
+
+void WaveletNN::trainWeightsDense()
+{
+	unsigned int i, j, ldh = _kMeans.size() + 1;
 	leda::matrix hiddenLayerM;
 	leda::vector Y;
+	AlignedArray H( (unsigned long)_samples.size() * ldh );
 
 	hiddenLayerM 	= leda::matrix( _samples.size(), _kMeans.size() + 1 );
 	_weights 		= leda::vector( _kMeans.size() + 1 );
 	Y				= leda::vector( _samples.size() );
 
+	hiddenLayer( _samples, H.data(), ldh );
 
 	for ( i = 0; i < _samples.size(); ++i )
 	{
-		hiddenLayerM( i, 0 ) = 1.0;
-		for ( j = 1; j < _kMeans.size() + 1; ++j )
+		for ( j = 0; j < ldh; ++j )
 		{
-			hiddenLayerM( i, j ) = WaveletNN::mexicanHatWavelet( _samples[i], _kMeans[j-1], _radius );
+			hiddenLayerM( i, j ) = H[ (unsigned long)i * ldh + j ];
 		}
 		Y[i] = _samples[i][Param::InputSampleSize];
 	}
 
-	Util::log( INFO, "[WaveletNN::trainWeights()] Hidden layer set.");
+	Util::log( INFO, "[WaveletNN::trainWeightsDense()] Hidden layer set.");
 
 	leda::matrix Mtrans = hiddenLayerM.trans();
-	Util::log( INFO, "[WaveletNN::trainWeights()] M_trans estimated.");
+	Util::log( INFO, "[WaveletNN::trainWeightsDense()] M_trans estimated.");
 
 	leda::matrix M 		= Mtrans * hiddenLayerM ;
-	Util::log( INFO, "[WaveletNN::trainWeights()] M_inv step one done.");
+	Util::log( INFO, "[WaveletNN::trainWeightsDense()] M_inv step one done.");
 
 	leda::matrix Minv	= M.inv() * Mtrans;
-	Util::log( INFO, "[WaveletNN::trainWeights()] M_inv done.");
+	Util::log( INFO, "[WaveletNN::trainWeightsDense()] M_inv done.");
 
 	_weights = Minv * Y;
 
-	Util::log( INFO, "[WaveletNN::trainWeights()] Weights trained.");
+	Util::log( INFO, "[WaveletNN::trainWeightsDense()] Weights trained.");
 
 	cout<< "Weights : "<< endl;
 	_weights.print();
@@ -221,24 +827,23 @@ void WaveletNN::trainWeights()
 
 
 
-float WaveletNN::predict( vector<float> sample )
+float WaveletNN::predict( const SampleView &sample )
 {
 	leda::vector h( _kMeans.size() + 1 );
 	float y;
 
-	if ( sample.size() < Param::InputSampleSize + Param::NumPredBars )
+	if ( sample.size() < (unsigned int)( Param::InputSampleSize + Param::NumPredBars ) )
 	{
 		throw length_error( string("Sample length [") + Util::itoa( sample.size() )
 							+ "] must be :" + Util::itoa( Param::InputSampleSize ) + "." );
 	}
-	vector<float> s( sample.begin(), sample.begin() + Param::InputSampleSize );
 
 
 	// project to K-wavelet feature space
 	h[0] = 1.0;
 	for ( unsigned int i = 1; i <= _kMeans.size(); ++i )
 	{
-		h[i] = WaveletNN::mexicanHatWavelet( s, _kMeans[i], _radius );
+		h[i] = WaveletNN::mexicanHatWavelet( sample, _kMeans[i-1], _radius );
 	}
 
 	y = h * _weights;
@@ -248,7 +853,7 @@ float WaveletNN::predict( vector<float> sample )
 	return y;
 }
 
-WaveletNN::Error WaveletNN::getError( leda::vector fx, vector< vector<float> > y )
+WaveletNN::Error WaveletNN::getError( leda::vector fx, vector<float> y )
 {
 	Error er;
 	unsigned int direrr =0;
@@ -257,11 +862,11 @@ WaveletNN::Error WaveletNN::getError( leda::vector fx, vector< vector<float> > y
 
 	for ( unsigned int i = 0; i < y.size(); ++i )
 	{
-		//cout<< "y = "<< y[i][0];
+		//cout<< "y = "<< y[i];
 		//cout<< " fx = "<< fx[1];
 
 		// directional error
-		if (  ( y[i][0] < 0  &&  fx[1] > 0 ) || ( y[i][0] > 0  &&  fx[1] < 0 ) )
+		if (  ( y[i] < 0  &&  fx[i] > 0 ) || ( y[i] > 0  &&  fx[i] < 0 ) )
 		{
 			// directional error
 			++direrr;
@@ -275,7 +880,7 @@ WaveletNN::Error WaveletNN::getError( leda::vector fx, vector< vector<float> > y
 	}
 	cout<< endl<< endl;
 
-	er.directional_err = 100 * direrr / y.size();
+	er.directional_err = 100.0 * direrr / y.size();
 
 	er.mean_sqr_err = 0.0;
 	er.mean_fractional_error = 0.0;
@@ -288,44 +893,134 @@ WaveletNN::Error WaveletNN::getError( leda::vector fx, vector< vector<float> > y
 }
 
 
-leda::vector WaveletNN::predict( vector< vector<float> > samples ) const
+leda::vector WaveletNN::predict( const vector<SampleView> &samples ) const
 {
-	leda::matrix M( samples.size(), _kMeans.size() + 1 );
+	vector<SampleView> valid;
+	unsigned int ldh = _kMeans.size() + 1;
 	leda::vector fx;
-	vector< vector<float> > y;
+	vector<float> y;
 
 	cout<< "done"<< endl;
 
+	valid.reserve( samples.size() );
 	for ( unsigned int i = 0; i < samples.size(); ++i )
 	{
-		if ( samples[i].size() < Param::InputSampleSize + Param::NumPredBars )
+		if ( samples[i].size() < (unsigned int)( Param::InputSampleSize + Param::NumPredBars ) )
 		{
 			Util::log( ERROR, string("Sample length [") + Util::itoa( samples[i].size() )
 								+ "] must be :" + Util::itoa( Param::InputSampleSize ) + "." );
 			continue;
 		}
 
-		vector<float> yy(1);
-		yy[0] = samples[i][Param::InputSampleSize];
-		y.push_back( yy );
+		valid.push_back( samples[i] );
+		y.push_back( samples[i][Param::InputSampleSize] );
+	}
+
+	AlignedArray H( (unsigned long)valid.size() * ldh );
+	hiddenLayer( valid, H.data(), ldh );
+
+	cout<< "done1"<< endl;
+
+	evaluate( H.data(), ldh, y, fx );
+
+	return fx;
+}
+
+
+WaveletNN::Error WaveletNN::test() const
+{
+	unsigned int ldh = _kMeans.size() + 1;
+	leda::vector fx;
+	vector<float> y;
+
+	AlignedArray H( (unsigned long)_testData.size() * ldh );
+	if ( _testDistances.size() > 0 )
+	{
+		hiddenLayer( _testDistances.data(), _testData.size(), H.data(), ldh );
+	}
+	else
+	{
+		hiddenLayer( _testData, H.data(), ldh );
+	}
+
+	y.reserve( _testData.size() );
+	for ( unsigned int i = 0; i < _testData.size(); ++i )
+	{
+		y.push_back( _testData[i][Param::InputSampleSize] );
+	}
+
+	if ( _cutoff > 0 )
+	{
+		return evaluateSparse( H.data(), ldh, y, fx );
+	}
+	return evaluate( H.data(), ldh, y, fx );
+}
+
 
+/* The test error of the sparse hidden layer, with how far the cutoff moves the
+ * outputs from those of the dense one in h, under the same weights.
+ */
+WaveletNN::Error WaveletNN::evaluateSparse( const float *h, unsigned int ldh, const vector<float> &y, leda::vector &fx ) const
+{
+	const unsigned long n = y.size();
+	SparseRows S;
+	double f, g, diff, sum2 = 0, maxDiff = 0;
+
+	if ( _testDistances.size() > 0 )
+	{
+		sparseHiddenLayer( _testDistances.data(), n, S );
+	}
+	else
+	{
+		sparseHiddenLayer( _testData, 0, n, S );
+	}
 
-		M( i, 0 ) = 1.0;
-		for ( unsigned int j = 0; j < _kMeans.size(); ++j )
+	fx = leda::vector( n );
+	for ( unsigned long i = 0; i < n; ++i )
+	{
+		f = g = 0;
+		for ( unsigned long a = S.start[i]; a < S.start[i+1]; ++a )
 		{
-			M( i, j+1) = WaveletNN::mexicanHatWavelet( samples[i], _kMeans[j], _radius );
+			f += S.value[a] * _weights[ S.column[a] ];
 		}
-	}
+		for ( unsigned int j = 0; j < ldh; ++j )
+		{
+			g += h[ i * ldh + j ] * _weights[j];
+		}
+		fx[i] = f;
 
-	cout<< "done1"<< endl;
+		diff = fabs( f - g );
+		sum2 += diff * diff;
+		maxDiff = max( maxDiff, diff );
+	}
 
-	fx = M * _weights;
+	Util::log( INFO, string("[WaveletNN::evaluateSparse()] Cutoff at ") + Util::ftoa( _cutoff ) + " radii kept "
+					 + Util::ftoa( 100.0 * ( S.value.size() - n ) / ( n * ( ldh - 1 ) ) )
+					 + "% of the activations; each one dropped is at most " + Util::ftoa( cutoffBound( _cutoff ) * _scale )
+					 + ". Output change: rms " + Util::ftoa( n ? sqrt( sum2 / n ) : 0 )
+					 + ", max " + Util::ftoa( maxDiff ) + "." );
 
 	cout<< "\n\nGetting error"<< endl;
 
-	WaveletNN::getError( fx, y );
-
-	return fx;
+	return WaveletNN::getError( fx, y );
 }
 
 
+WaveletNN::Error WaveletNN::evaluate( const float *h, unsigned int ldh, const vector<float> &y, leda::vector &fx ) const
+{
+	leda::matrix M( y.size(), ldh );
+
+	for ( unsigned int i = 0; i < y.size(); ++i )
+	{
+		for ( unsigned int j = 0; j < ldh; ++j )
+		{
+			M( i, j ) = h[ (unsigned long)i * ldh + j ];
+		}
+	}
+
+	fx = M * _weights;
+
+	cout<< "\n\nGetting error"<< endl;
+
+	return WaveletNN::getError( fx, y );
+}
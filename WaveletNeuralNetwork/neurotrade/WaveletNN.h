@@ -14,7 +14,11 @@
 #include <LEDA/numbers/vector.h>
 
 #include "def.h"
+#include "SampleStore.h"
+#include "AlignedArray.h"
 #include "KMeansClustering.h"
+#include "VPTree.h"
+#include "NormalEquations.h"
 
 
 using namespace std;
@@ -32,19 +36,25 @@ class WaveletNN
 		float mean_fractional_error;
 	};
 
-	static WaveletNN::Error getError( leda::vector fx, vector< vector<float> > y );
+	static WaveletNN::Error getError( leda::vector fx, vector<float> y );
 
 
   public:
 
-	WaveletNN() : _usedAllTrainingData( false ) {};
+	WaveletNN() : _radius( 0 ), _meanNearest( 0 ), _scale( 0 ), _r_2( 0 ), _cutoff( Param::Wavelet_Cutoff ),
+				  _usedAllTrainingData( false ), _fixedTestData( false ), _treeMaxK( 0 ), _treeKey( 0 ) {};
 
-	void addSample( deque<float> s )
-		{
-			vector<float> s1( s.begin(), s.end() );
-			_samples.push_back( s1 );
-		}
-	void addSample( vector<float> s )
+	// Takes a view of every window in the store; the store must outlive the network.
+	void setSamples( const SampleStore &store );
+
+	// The same for windows [begin, end) of the store only.
+	void setSamples( const SampleStore &store, unsigned long begin, unsigned long end );
+
+	/* Takes windows [begin, end) of the store as the test data. The network is
+	 * then trained on all of its samples, rather than holding out every tenth.
+	 */
+	void setTestData( const SampleStore &store, unsigned long begin, unsigned long end );
+	void addSample( const SampleView &s )
 		{ _samples.push_back(s); }
 
 	unsigned int getNumSamples() const { return _samples.size(); }
@@ -53,30 +63,161 @@ class WaveletNN
 	void initClustersTestData( KMeansClustering &kMeansClusters, bool useAllTrainingData );
 
 
-	static float mexicanHatWavelet( vector<float> sample, vector<float> mean, float radius );
+	static float mexicanHatWavelet( const SampleView &sample, const vector<float> &mean, float radius );
 
-	// K is the number of means
-	void setWaveletMeansAndRadius( unsigned int k, float f );
+	// The A in A ( 1 - t / r^2 ) exp( -t / 2r^2 )
+	static float waveletScale( float radius );
+
+	/* Where to keep the tree of bisections, so that plain bisecting clustering
+	 * runs once for every K the tree reaches; empty not to. Only a tree of a
+	 * fixed Param::KMeansSeed is kept.
+	 */
+	void setClusterTreePath( const string &path ) { _treePath = path; }
 
+	// How far plain bisecting clustering grows the tree, past K, for other Ks to be cut from it; 0 for K.
+	void setClusterTreeMaxK( unsigned int k ) { _treeMaxK = k; }
+
+	/* The tree of the last bisecting clustering, and the key of the samples and
+	 * settings it was grown for, as KMeansClustering::getTreeKey(). Given to
+	 * another network, that one cuts its means from it for any K the tree
+	 * reaches, rather than clustering again, if its own key is the same.
+	 */
+	const BisectionTree &getClusterTree() const { return _tree; }
+	unsigned long long getClusterTreeKey() const { return _treeKey; }
+	void setClusterTree( const BisectionTree &tree, unsigned long long key ) { _tree = tree; _treeKey = key; }
+
+	// K is the number of means
+	void setWaveletMeansAndRadius( unsigned int k, float f,
+								   KMeansClustering::Method method = KMeansClustering::BISECTING,
+								   KMeansClustering::Seeding seeding = KMeansClustering::UNIFORM );
+
+	// The radius as f times the mean distance between nearest means, as set above.
+	void setRadiusFactor( float f );
+
+	/* Takes the wavelet of a mean as 0 for samples more than c radii from it, and
+	 * keeps the hidden layer as sparse rows, of the means within reach only. Those
+	 * are found from a vantage point tree over the means, not by measuring every
+	 * distance. test() reports how far the cutoff moves the outputs. 0 for none.
+	 */
+	void setCutoff( float c );
+	float getCutoff() const { return _cutoff; }
+
+	// The largest wavelet, over A, dropped by a cutoff at c radii.
+	static float cutoffBound( float c );
+
+	/* Keeps the squared distances of the training and test samples to the means,
+	 * which do not depend on the radius. While they are kept, trainWeights() and
+	 * test() only apply the wavelet to them. Setting the means drops them.
+	 */
+	void cacheDistances();
+	void clearDistances();
+
+	/* Trains and tests for each radius factor in turn, from the cached distances,
+	 * and leaves the network trained at the one of best directional accuracy.
+	 * Returns the test error of each.
+	 */
+	vector<Error> sweepRadiusFactors( const vector<float> &factors );
+
+	/* Least squares weights from the normal equations, gathered a block of
+	 * samples at a time, so the hidden layer is never held whole. The samples
+	 * are gathered in parallel, into a Gram matrix per chunk of them.
+	 */
 	void trainWeights();
 
-	float predict( vector<float> sample );
-	leda::vector predict( vector< vector<float> > samples ) const;
+	// The same from the whole hidden layer and its explicit inverse; for comparison.
+	void trainWeightsDense();
 
-	void test() const { predict( _testData ); }
+	float predict( const SampleView &sample );
+	leda::vector predict( const vector<SampleView> &samples ) const;
+
+	Error test() const;
 
 
   private:
 
+	friend class StreamingPredictor;
+	friend class ModelSnapshot;
+
 	leda::vector _weights;
+	NormalEquations _normal;	// the weights were solved from, by trainWeights()
 
 	vector< vector<float> > _kMeans;
 	float					_radius;
+	float					_meanNearest;	// the mean distance between nearest means
+
+	// the means again, a row of AlignedArray::stride() floats each, with their squared norms
+	AlignedArray	_centres;
+	vector<float>	_centreNorms;
+	float			_scale;		// waveletScale( _radius )
+	float			_r_2;		// 1 / _radius^2
+
+	float			_cutoff;		// in radii; 0 for none
+	VPTree			_centreTree;	// over _centres, while there is a cutoff
+
+	void setCentres();
+
+	/* The hidden layer for samples [begin, end): row i at h + ( i - begin ) ldh is
+	 * 1 and then the wavelet of each mean. The distances come from
+	 * |x|^2 + |m|^2 - 2 x.m, with the dot products as a blocked matrix product.
+	 * For windows that follow one another along the series, as a walk through
+	 * it gives, the |x|^2 slide along with them.
+	 */
+	void hiddenLayer( const vector<SampleView> &samples, unsigned long begin, unsigned long end,
+					  float *h, unsigned int ldh ) const;
+
+	// the same, over the default thread pool
+	void hiddenLayer( const vector<SampleView> &samples, float *h, unsigned int ldh ) const;
 
-	vector< vector<float> > _samples;
-	vector< vector<float> > _testData;
+	// the same from numRows rows of K squared distances
+	void hiddenLayer( const float *d, unsigned long numRows, float *h, unsigned int ldh ) const;
+
+	// the squared distances of samples [begin, end) to the means, a row of them ldd floats apart
+	void squaredDistances( const vector<SampleView> &samples, unsigned long begin, unsigned long end,
+						   float *d, unsigned int ldd ) const;
+
+	// the output for each row of the hidden layer, and its error against y
+	Error evaluate( const float *h, unsigned int ldh, const vector<float> &y, leda::vector &fx ) const;
+	Error evaluateSparse( const float *h, unsigned int ldh, const vector<float> &y, leda::vector &fx ) const;
+
+	// The hidden layer in compressed sparse rows: row i is [start[i], start[i+1]).
+	struct SparseRows
+	{
+		vector<unsigned long>	start;
+		vector<unsigned int>	column;
+		vector<float>			value;
+
+		SparseRows() : start( 1, 0 ) {}
+		void clear() { start.assign( 1, 0 ); column.clear(); value.clear(); }
+	};
+
+	/* Appends the sparse rows of samples [begin, end), of the means within the
+	 * cutoff; returns the number of distances measured to find them.
+	 */
+	unsigned long sparseHiddenLayer( const vector<SampleView> &samples, unsigned long begin, unsigned long end,
+									 SparseRows &h ) const;
+
+	// the same from numRows rows of K squared distances
+	unsigned long sparseHiddenLayer( const float *d, unsigned long numRows, SparseRows &h ) const;
+
+	void appendSparseRow( vector< pair<unsigned int, float> > &near, SparseRows &h ) const;
+
+	class HiddenLayerTask;
+	class GramTask;
+	class DistanceTask;
+
+	AlignedArray	_trainDistances;	// _samples x K, when cached
+	AlignedArray	_testDistances;		// _testData x K
+
+	vector<SampleView> _samples;
+	vector<SampleView> _testData;
 
 	bool	_usedAllTrainingData;
+	bool	_fixedTestData;		// set by setTestData()
+
+	string				_treePath;
+	unsigned int		_treeMaxK;
+	BisectionTree		_tree;
+	unsigned long long	_treeKey;	// of _tree
 
 };
 
@@ -5,9 +5,16 @@
  *      Author: jeevw
  */
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
 #include <sstream>
 #include <time.h>
 #include <stdexcept>
+#include <stdlib.h>
+#include <vector>
 #include "def.h"
 
 const string Param::DBName("neurotrdb");
@@ -15,7 +22,21 @@ const string Param::DBServerName( "myodbc5" ); //"neurotrade_neurotrdb");
 const string Param::DBUser("neurotr");
 const string Param::DBPasswd("neurotr");
 const string Param::DBDataDir("/usr/local/data/neurotr/data");
+const string Param::CacheDir("/usr/local/data/neurotr/cache");
+const string Param::SweepResultsFile("neurotrade_sweep.txt");
 
+const float Param::KMeans_MiniBatch_Tolerance = 0.001;
+const float Param::Radius_Factor = 2.5;
+const float Param::Wavelet_Cutoff = 0;
+const float Param::RLS_Forgetting = 1.0;
+
+int Param::InputSampleSize = 80;
+int Param::KMeans_Bisecting_Runs = 12;
+unsigned int Param::KMeansSeed = 0;
+int Param::NumPredBars = 1;
+
+
+const float Util::float_zero = 0.00001;
 
 string Util::_logLevel[] = { "SUCCESS", "INFO", "DEBUG", "ERROR", "CRITICAL" };
 
@@ -66,6 +87,124 @@ float Util::atof( string s )
 }
 
 
+// a buffer laid out whole
+class BufferWriter: public Util::FileWriter
+{
+  public:
+
+	BufferWriter( const void *data, size_t n ) : _data(data), _n(n) {}
+
+	bool write( FILE *f ) { return fwrite( _data, 1, _n, f ) == _n; }
+
+
+  private:
+
+	const void	*_data;
+	size_t		_n;
+
+};
+
+
+bool Util::writeFile( const string &path, FileWriter &writer, const string &what )
+{
+	// a temporary file of its own, so two processes writing the same path do not write into one
+	string tmpPath = path + ".XXXXXX";
+	vector<char> name( tmpPath.begin(), tmpPath.end() );
+	bool ok;
+	FILE *f;
+	int fd;
+
+	name.push_back( '\0' );
+	fd = mkstemp( &name[0] );
+	if ( fd < 0 )
+	{
+		log( ERROR, "[Util::writeFile()] Cannot write " + what + ": " + tmpPath );
+		return false;
+	}
+	tmpPath = &name[0];
+	// mkstemp() makes it for the owner only; let others read it, as before
+	fchmod( fd, 0644 );
+	f = fdopen( fd, "wb" );
+	if ( !f )
+	{
+		log( ERROR, "[Util::writeFile()] Cannot write " + what + ": " + tmpPath );
+		close( fd );
+		unlink( tmpPath.c_str() );
+		return false;
+	}
+	ok = writer.write( f );
+	ok = ( fclose( f ) == 0 ) && ok;
+	if ( ok )
+	{
+		ok = ( rename( tmpPath.c_str(), path.c_str() ) == 0 );
+	}
+	if ( !ok )
+	{
+		log( ERROR, "[Util::writeFile()] Failed writing " + what + ": " + path );
+		unlink( tmpPath.c_str() );
+	}
+
+	return ok;
+}
+
+
+bool Util::writeFile( const string &path, const void *data, size_t n, const string &what )
+{
+	BufferWriter writer( data, n );
+
+	return writeFile( path, writer, what );
+}
+
+
+void *Util::mapFile( const string &path, size_t minLen, size_t &len )
+{
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open( path.c_str(), O_RDONLY );
+	if ( fd < 0 )
+	{
+		return NULL;
+	}
+	if ( fstat( fd, &st ) != 0  ||  (size_t)st.st_size < minLen )
+	{
+		close( fd );
+		return NULL;
+	}
+
+	len = st.st_size;
+	map = mmap( NULL, len, PROT_READ, MAP_SHARED, fd, 0 );
+	close( fd );
+
+	return ( map == MAP_FAILED ) ? NULL : map;
+}
+
+
+bool Util::hasTag( const void *header, const char magic[8], unsigned int version )
+{
+	unsigned int v;
+
+	memcpy( &v, (const char *)header + 8, sizeof(v) );
+	return memcmp( header, magic, 8 ) == 0  &&  v == version;
+}
+
+
+bool Util::sectionsFit( size_t len, size_t headerLen, const unsigned long long offset[],
+						const unsigned long long length[], unsigned int n, size_t alignment )
+{
+	for ( unsigned int s = 0; s < n; ++s )
+	{
+		if ( offset[s] % alignment != 0  ||  offset[s] < headerLen  ||  offset[s] > len
+			 ||  length[s] > len - offset[s] )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+
 string Util::getTimestamp()
 {
 	time_t ltime;
@@ -80,6 +219,28 @@ string Util::getTimestamp()
 }
 
 
+double Util::getTime()
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+unsigned long long Util::hashBytes( unsigned long long h, const void *p, size_t n )
+{
+	const unsigned char *c = (const unsigned char *)p;
+
+	for ( size_t i = 0; i < n; ++i )
+	{
+		h ^= c[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+
 void Util::log( LogSeverity level, string msg)
 {
 	if ( level == SUCCESS )
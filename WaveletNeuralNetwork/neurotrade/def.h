@@ -9,6 +9,8 @@
 #define _NEUROTRADE_DEF_H_
 
 #include <iostream>
+#include <stddef.h>
+#include <stdio.h>
 
 
 using namespace std;
@@ -22,14 +24,43 @@ public:
 	  static const string DBUser;
 	  static const string DBPasswd;
 	  static const string DBDataDir;
+	  static const string CacheDir;	// the returns cache of the bar data files
 
-	  static const int InputSampleSize = 80;
+	  static const unsigned int DBFetchBlockSize = 8192;	// rows per SQLFetch; 1 for row by row
 
-	  static const int KMeans_Bisecting_Runs = 12;
+	  static const unsigned int Roll_Confirm_Bars = 20;	// bars in a row another contract must out-trade the one in use in, to roll to it
 
-	  static const int Radius_Factor = 2.5;
+	  static const unsigned int NumThreads = 0;	// of the thread pool; 0 for one per core
 
-	  static const int NumPredBars = 1;
+	  static int InputSampleSize;	// returns a sample takes in; --window
+
+	  static int KMeans_Bisecting_Runs;	// trials a bisection picks the best of; --bisecting-runs
+
+	  static unsigned int KMeansSeed;	// of the bisection trials; 0 for one from the clock; --seed
+
+	  static const unsigned int KMeans_Lloyd_Iterations = 100;	// at most, to refine the bisected means
+
+	  static const unsigned int KMeans_MiniBatch_Size = 1024;
+	  static const unsigned int KMeans_MiniBatch_Iterations = 1000;	// batches at most
+	  static const unsigned int KMeans_MiniBatch_Patience = 10;	// batches in a row under the tolerance to stop
+	  static const float KMeans_MiniBatch_Tolerance;	// of the largest move of a mean, to the batch's mean distance
+
+	  static const unsigned int KMeans_Parallel_Rounds = 5;	// of k-means|| seeding
+	  static const unsigned int KMeans_Parallel_Oversampling = 2;	// samples drawn per round, per mean
+
+	  static const float Radius_Factor;
+
+	  static const float Wavelet_Cutoff;	// radii past which a mean's wavelet is taken as 0; 0 for none
+
+	  static int NumPredBars;	// returns a window takes after its sample; --predbars
+
+	  static const float RLS_Forgetting;	// of the online weight updates, a bar; 1 for none
+	  static const unsigned int RLS_Resync_Interval = 4096;	// bars between full solves of the online weights
+
+	  static const unsigned int WalkForward_Train_Bars = 8000;	// returns a walk-forward fold trains on
+	  static const unsigned int WalkForward_Test_Bars = 1000;	// and then tests on, the step between folds too
+
+	  static const string SweepResultsFile;	// the table a parameter sweep writes
 
 };
 
@@ -47,11 +78,44 @@ class Util
 {
   public:
 
-	static const float float_zero = 0.00001;
+	static const float float_zero;
 
 	static string itoa( int i );
 	static string ftoa( float i );
 	static string getTimestamp();
+	static double getTime();	// seconds, monotonic; for timing
+
+	// FNV-1a, from HashSeed or a hash so far; for the keys of the cache files
+	static unsigned long long hashBytes( unsigned long long h, const void *p, size_t n );
+	static const unsigned long long HashSeed = 14695981039346656037ULL;
+
+	/* The binary files the program keeps (the returns cache, the bisection
+	 * tree, the model) all start with an 8 byte magic and then a version.
+	 * A writer fills one through writeFile(), which writes it to a temporary
+	 * file and renames that over the path, so a reader never sees half of it.
+	 */
+	class FileWriter
+	{
+	  public:
+		virtual ~FileWriter() {}
+		virtual bool write( FILE *f ) = 0;
+	};
+
+	// Writes the file whole or not at all; what names it in the log. Returns false if it is not written.
+	static bool writeFile( const string &path, FileWriter &writer, const string &what );
+	static bool writeFile( const string &path, const void *data, size_t n, const string &what );
+
+	// Maps a whole file read only and shared, if it is at least minLen bytes; NULL if not.
+	static void *mapFile( const string &path, size_t minLen, size_t &len );
+
+	// Whether a file's header starts with the magic and version.
+	static bool hasTag( const void *header, const char magic[8], unsigned int version );
+
+	/* Whether n sections, of the given byte offsets and lengths, lie within a
+	 * file of len bytes, past its header and each aligned to alignment.
+	 */
+	static bool sectionsFit( size_t len, size_t headerLen, const unsigned long long offset[],
+							 const unsigned long long length[], unsigned int n, size_t alignment );
 
 	static int	 atoi( string s );
 	static float atof( string s );
@@ -7,55 +7,272 @@
 //============================================================================
 
 #include <iostream>
+#include <string.h>
 
 #include "def.h"
 #include "neurotrdb.h"
+#include "SampleStore.h"
+#include "BarLoader.h"
+#include "ReturnsCache.h"
 
 #include "WaveletNN.h"
 #include "KMeansClustering.h"
+#include "StreamingPredictor.h"
+#include "ModelSnapshot.h"
+#include "WalkForward.h"
+#include "ParameterSweep.h"
 
 
 using namespace std;
 
 
 
+// the fields of s between the separators
+static vector<string> split( const string &s, char separator )
+{
+	vector<string> fields;
+	size_t p = 0, q;
+
+	do
+	{
+		q = s.find( separator, p );
+		fields.push_back( s.substr( p, q - p ) );
+		p = q + 1;
+	}
+	while ( q != string::npos );
+
+	return fields;
+}
+
+
+static vector<unsigned int> splitInts( const string &s )
+{
+	vector<string> f = split( s, ',' );
+	vector<unsigned int> v;
+
+	for ( unsigned int i = 0; i < f.size(); ++i )
+	{
+		v.push_back( Util::atoi( f[i] ) );
+	}
+	return v;
+}
+
+
+static vector<float> splitFloats( const string &s )
+{
+	vector<string> f = split( s, ',' );
+	vector<float> v;
+
+	for ( unsigned int i = 0; i < f.size(); ++i )
+	{
+		v.push_back( Util::atof( f[i] ) );
+	}
+	return v;
+}
+
+
+
 int main(int argc, char **argv)
 {
     Param param;
     NeuroTrDb db;
+    BarLoader loader;
+    ReturnsCache cache;		// must outlive the store mapped on it
+    SampleStore store;
     string msg;
 
     WaveletNN wnn;
+    ModelSnapshot model;	// must outlive the predictors scoring from it
 
     int KMeans = 0;
     float RFactor = Param::Radius_Factor;
+    bool useDb = false, useCache = true, dense = false, latency = false, online = false;
+    KMeansClustering::Method clustering = KMeansClustering::BISECTING;
+    KMeansClustering::Seeding seeding = KMeansClustering::UNIFORM;
+    vector<float> radii;
+    string savePath, loadPath;
+    vector<unsigned int> walk;
+    vector<string> sweep, sweepRandom;
+    string sweepPath = Param::SweepResultsFile;
+    int numArgs = 0;
 
-    if ( argc > 1 )
-    {
-    	KMeans = Util::atoi( argv[1] );
-    }
-    if ( argc > 2 )
+    // usage: neurotrade [K [RFactor]] [--db] [--nocache] [--dense] [--refine | --minibatch | --lloyd] [--kmeanspp]
+    //                   [--radii RF1,RF2,...] [--cutoff C] [--latency [--online]]
+    //                   [--save-model FILE | --load-model FILE] [--walkforward M,H[,STEP]]
+    //                   [--sweep K1,K2,...:RF1,RF2,...[:W1,W2,...] | --sweep-random N:KMIN,KMAX:RFMIN,RFMAX[:W1,W2,...]]
+    //                   [--sweep-out FILE] [--window N] [--predbars N] [--bisecting-runs N]
+    //                   [--seed N] [--tree-maxk N]
+    for ( int i = 1; i < argc; ++i )
     {
-    	RFactor = Util::atof( argv[2] );
-    	if ( RFactor > 6.0 ||  RFactor < 0.5 )
+    	if ( strcmp( argv[i], "--db" ) == 0 )
+    	{
+    		useDb = true;	// load and read the bars through the database
+    	}
+    	else if ( strcmp( argv[i], "--nocache" ) == 0 )
+    	{
+    		useCache = false;	// parse the bar data files and cluster even if they are cached
+    	}
+    	else if ( strcmp( argv[i], "--dense" ) == 0 )
+    	{
+    		dense = true;	// train on the whole hidden layer matrix
+    	}
+    	else if ( strcmp( argv[i], "--refine" ) == 0 )
+    	{
+    		clustering = KMeansClustering::BISECTING_REFINED;	// run Lloyd iterations on the bisected means
+    	}
+    	else if ( strcmp( argv[i], "--minibatch" ) == 0 )
+    	{
+    		clustering = KMeansClustering::MINI_BATCH;	// for histories too long to cluster whole
+    	}
+    	else if ( strcmp( argv[i], "--lloyd" ) == 0 )
+    	{
+    		clustering = KMeansClustering::LLOYD;	// Lloyd iterations from k-means|| seeds
+    	}
+    	else if ( strcmp( argv[i], "--kmeanspp" ) == 0 )
+    	{
+    		seeding = KMeansClustering::KMEANS_PP;	// the bisection trials' second seed by k-means++
+    	}
+    	else if ( strcmp( argv[i], "--radii" ) == 0  &&  i + 1 < argc )
+    	{
+    		radii = splitFloats( argv[++i] );	// train and test for each radius factor, from one set of distances
+    	}
+    	else if ( strcmp( argv[i], "--latency" ) == 0 )
+    	{
+    		latency = true;		// time the streaming predictor over the series
+    	}
+    	else if ( strcmp( argv[i], "--online" ) == 0 )
+    	{
+    		online = true;		// and refit the weights bar by bar as it goes
+    	}
+    	else if ( strcmp( argv[i], "--save-model" ) == 0  &&  i + 1 < argc )
+    	{
+    		savePath = argv[++i];	// keep the trained network
+    	}
+    	else if ( strcmp( argv[i], "--load-model" ) == 0  &&  i + 1 < argc )
+    	{
+    		loadPath = argv[++i];	// predict from a kept network, without training
+    	}
+    	else if ( strcmp( argv[i], "--walkforward" ) == 0  &&  i + 1 < argc )
+    	{
+    		walk = splitInts( argv[++i] );	// train on M returns, test on the H after them, and step forward
+    	}
+    	else if ( strcmp( argv[i], "--sweep" ) == 0  &&  i + 1 < argc )
+    	{
+    		sweep = split( argv[++i], ':' );	// every combination of Ks, RFactors and windows
+    	}
+    	else if ( strcmp( argv[i], "--sweep-random" ) == 0  &&  i + 1 < argc )
+    	{
+    		sweepRandom = split( argv[++i], ':' );	// N combinations drawn from the ranges
+    	}
+    	else if ( strcmp( argv[i], "--sweep-out" ) == 0  &&  i + 1 < argc )
+    	{
+    		sweepPath = argv[++i];
+    	}
+    	else if ( strcmp( argv[i], "--window" ) == 0  &&  i + 1 < argc )
+    	{
+    		Param::InputSampleSize = Util::atoi( argv[++i] );	// the returns a sample takes in
+    		if ( Param::InputSampleSize < 1 )
+    		{
+    			Util::log( ERROR, "[main()] A window takes 1 return or more." );
+    			return 1;
+    		}
+    	}
+    	else if ( strcmp( argv[i], "--predbars" ) == 0  &&  i + 1 < argc )
+    	{
+    		Param::NumPredBars = Util::atoi( argv[++i] );
+    		if ( Param::NumPredBars < 1 )
+    		{
+    			Util::log( ERROR, "[main()] A window predicts 1 bar or more." );
+    			return 1;
+    		}
+    	}
+    	else if ( strcmp( argv[i], "--bisecting-runs" ) == 0  &&  i + 1 < argc )
+    	{
+    		Param::KMeans_Bisecting_Runs = Util::atoi( argv[++i] );	// trials a bisection picks the best of
+    		if ( Param::KMeans_Bisecting_Runs < 1 )
+    		{
+    			Util::log( ERROR, "[main()] A bisection takes 1 trial or more." );
+    			return 1;
+    		}
+    	}
+    	else if ( strcmp( argv[i], "--seed" ) == 0  &&  i + 1 < argc )
+    	{
+    		Param::KMeansSeed = Util::atoi( argv[++i] );	// a fixed clustering, whose bisection tree is kept
+    	}
+    	else if ( strcmp( argv[i], "--tree-maxk" ) == 0  &&  i + 1 < argc )
+    	{
+    		wnn.setClusterTreeMaxK( Util::atoi( argv[++i] ) );	// bisect this far, so any K up to it is a cut
+    	}
+    	else if ( strcmp( argv[i], "--cutoff" ) == 0  &&  i + 1 < argc )
+    	{
+    		wnn.setCutoff( Util::atof( argv[++i] ) );	// a sparse hidden layer, of the means within C radii
+    	}
+    	else if ( ++numArgs == 1 )
+    	{
+    		KMeans = Util::atoi( argv[i] );
+    	}
+    	else if ( numArgs == 2 )
     	{
-    		RFactor = Param::Radius_Factor;
+    		RFactor = Util::atof( argv[i] );
+    		if ( RFactor > 6.0 ||  RFactor < 0.5 )
+    		{
+    			RFactor = Param::Radius_Factor;
+    		}
     	}
     }
 
     cout << "Hello. Welcome to NeuroTrade." << std::endl;
 
-    msg = string("[main()] Connecting to database: ") + param.DBName;
-    Util::log( INFO, msg );
-    db.connect();
-    Util::log( INFO, "[main()] DB connected. \n");
+    // a kept network takes the window it was trained on
+    if ( !loadPath.empty() )
+    {
+    	if ( !model.map( loadPath ) )
+    	{
+    		return 1;
+    	}
+    	if ( model.getDimension() != (unsigned int)Param::InputSampleSize )
+    	{
+    		Util::log( INFO, string("[main()] The model takes a window of ") + Util::itoa( model.getDimension() )
+    						 + ", not " + Util::itoa( Param::InputSampleSize ) + "; using its window." );
+    		Param::InputSampleSize = model.getDimension();
+    	}
+    }
+    store.setWindowLength( Param::InputSampleSize + Param::NumPredBars );
+
+    if ( useDb )
+    {
+        msg = string("[main()] Connecting to database: ") + param.DBName;
+        Util::log( INFO, msg );
+        db.connect();
+        Util::log( INFO, "[main()] DB connected. \n");
 
-    Util::log( INFO, "[main()] Loading Data.");
-    db.loadData();
-    Util::log( INFO, "[main()] Data loaded. \n");
+        Util::log( INFO, "[main()] Loading Data.");
+        db.loadData();
+        Util::log( INFO, "[main()] Data loaded. \n");
 
-    Util::log( INFO, "[main()] Reading in samples from the database.");
-    db.readSamples( wnn );
+        Util::log( INFO, "[main()] Reading in samples from the database.");
+        db.readSamples( store );
+    }
+    else if ( useCache )
+    {
+        Util::log( INFO, "[main()] Loading Data from the returns cache of: " + Param::DBDataDir );
+        if ( cache.load( store ) < 0 )
+        {
+        	return 1;
+        }
+        Util::log( INFO, "[main()] Data loaded. \n");
+    }
+    else
+    {
+        Util::log( INFO, "[main()] Loading Data from: " + Param::DBDataDir );
+        if ( loader.loadDir( Param::DBDataDir ) < 0 )
+        {
+        	return 1;
+        }
+        loader.calcReturns( store );
+        Util::log( INFO, "[main()] Data loaded. \n");
+    }
+    wnn.setSamples( store );
     Util::log( INFO, "[main()] Wavelet NN Input Layer Ready.\n");
 
     /*
@@ -68,20 +285,113 @@ int main(int argc, char **argv)
     Util::log( INFO, "[main()] Clusters and test data initialized.\n");
 	*/
 
-    cout<< endl;
-    Util::log( INFO, "[main()] Setting Wavelet Means and Radius with K Means Clustering.");
-    wnn.setWaveletMeansAndRadius( KMeans, RFactor );
-    Util::log( SUCCESS, "[main()] Wavelet Means and Radius set with K Means Clustering.");
+    if ( !walk.empty() )
+    {
+    	WalkForward wf( store, walk[0], walk.size() > 1 ? walk[1] : Param::WalkForward_Test_Bars,
+    					walk.size() > 2 ? walk[2] : 0 );
+
+    	cout<< endl;
+    	wf.setNetwork( KMeans, RFactor, clustering, seeding, wnn.getCutoff() );
+    	wf.run();
+    	Util::log( SUCCESS, "[main()] Wavelet NN walked forward.");
+    	return 0;
+    }
+
+    if ( sweep.size() >= 2  ||  sweepRandom.size() >= 3 )
+    {
+    	ParameterSweep ps( store, clustering, seeding, wnn.getCutoff() );
+
+    	if ( useCache )
+    	{
+    		ps.setClusterTreePath( Param::CacheDir + "/kmeans.tree" );
+    	}
+    	if ( sweep.size() >= 2 )
+    	{
+    		ps.addGrid( splitInts( sweep[0] ), splitFloats( sweep[1] ),
+    					sweep.size() > 2 ? splitInts( sweep[2] ) : vector<unsigned int>() );
+    	}
+    	else
+    	{
+    		vector<unsigned int> k = splitInts( sweepRandom[1] );
+    		vector<float> rf = splitFloats( sweepRandom[2] );
+
+    		ps.addRandom( Util::atoi( sweepRandom[0] ), k.front(), k.back(), rf.front(), rf.back(),
+    					  sweepRandom.size() > 3 ? splitInts( sweepRandom[3] ) : vector<unsigned int>() );
+    	}
 
+    	cout<< endl;
+    	ps.run();
+    	if ( !ps.writeTable( sweepPath ) )
+    	{
+    		return 1;
+    	}
+    	Util::log( SUCCESS, "[main()] Wavelet NN parameters swept.");
+    	return 0;
+    }
 
-    cout<< endl;
-    wnn.trainWeights();
-    Util::log( SUCCESS, "[main()] Wavelet NN weights trained.");
-    Util::log( SUCCESS, "[main()] Wavelet NN trained.");
+    if ( !loadPath.empty() )
+    {
+    	double t0 = Util::getTime();
+    	vector<SampleView> windows;
 
+    	model.restore( wnn );
+    	Util::log( SUCCESS, string("[main()] Wavelet NN of K = ") + Util::itoa( model.getK() )
+    						+ " loaded from " + loadPath + " in " + Util::ftoa( Util::getTime() - t0 ) + " s." );
+
+    	cout<< "\nTesting on every window" << endl;
+    	windows.reserve( store.getNumWindows() );
+    	for ( unsigned long i = 0; i < store.getNumWindows(); ++i )
+    	{
+    		windows.push_back( store.getWindow(i) );
+    	}
+    	wnn.predict( windows );
+    }
+    else
+    {
+    	cout<< endl;
+    	Util::log( INFO, "[main()] Setting Wavelet Means and Radius with K Means Clustering.");
+    	if ( useCache )
+    	{
+    		wnn.setClusterTreePath( Param::CacheDir + "/kmeans.tree" );
+    	}
+    	wnn.setWaveletMeansAndRadius( KMeans, RFactor, clustering, seeding );
+    	Util::log( SUCCESS, "[main()] Wavelet Means and Radius set with K Means Clustering.");
 
-    cout<< "\nTesting" << endl;
-    wnn.test();
+
+    	cout<< endl;
+    	if ( !radii.empty() )
+    	{
+    		wnn.sweepRadiusFactors( radii );
+    		Util::log( SUCCESS, "[main()] Wavelet NN radius factors swept.");
+    	}
+    	else
+    	{
+    		if ( dense )
+    		{
+    			wnn.trainWeightsDense();
+    		}
+    		else
+    		{
+    			wnn.trainWeights();
+    		}
+    		Util::log( SUCCESS, "[main()] Wavelet NN weights trained.");
+    		Util::log( SUCCESS, "[main()] Wavelet NN trained.");
+
+
+    		cout<< "\nTesting" << endl;
+    		wnn.test();
+    	}
+
+    	if ( !savePath.empty()  &&  !ModelSnapshot::write( savePath, wnn ) )
+    	{
+    		return 1;
+    	}
+    }
+
+    if ( latency )
+    {
+    	StreamingPredictor::benchmark( wnn, store, online, model.isMapped() ? &model : NULL );
+    }
 
 
     cout << endl<< "\nNeurotrade exiting." << endl;
@@ -8,7 +8,6 @@
 #include <cstdlib>
 #include <dirent.h>
 #include <string.h>
-#include <deque>
 
 #include "neurotrdb.h"
 #include "def.h"
@@ -253,22 +252,21 @@ int NeuroTrDb::loadData()
 }
 
 
-int NeuroTrDb::readSamples( WaveletNN &wnn )
+int NeuroTrDb::readSamples( SampleStore &store, unsigned int blockSize )
 {
-	SQLHSTMT hstmt;
+	SQLHSTMT hstmt = SQL_NULL_HANDLE;
 	string sql;
-	int rc, rtn = 0, i = 0;
+	int rc, rtn = 0;
+	long rows;
+	double t0, secs;
 	bool wasConnected = _connected;
 
-	DbReturn r;
-	deque<float> sample( Param::InputSampleSize, 0);
-
 	if ( !_connected )
 	{
 		rc = connect();
 		if ( rc < 0 )
 		{
-			Util::log( ERROR, "[NeuroTrDb::getReturns()] Could not connect to the database." );
+			Util::log( ERROR, "[NeuroTrDb::readSamples()] Could not connect to the database." );
 			return -1;
 		}
 	}
@@ -276,66 +274,178 @@ int NeuroTrDb::readSamples( WaveletNN &wnn )
 	rc = SQLAllocHandle(SQL_HANDLE_STMT, _dbc, &hstmt);
 	if ( !SQL_SUCCEEDED(rc) )
 	{
-		Util::log( ERROR, "[NeuroTrDb::getReturns()] Could not allocate statement handle." );
-		handle_errors( SQL_HANDLE_STMT, hstmt );
+		Util::log( ERROR, "[NeuroTrDb::readSamples()] Could not allocate statement handle." );
+		handle_errors( SQL_HANDLE_DBC, _dbc );
 		rtn = -1;
-		goto execSQL_get_out;
+		goto readSamples_get_out;
+	}
+
+	if ( blockSize > 1 )
+	{
+		// column-wise binding of blockSize rows per SQLFetch
+		rc = SQLSetStmtAttr( hstmt, SQL_ATTR_ROW_BIND_TYPE, (SQLPOINTER)SQL_BIND_BY_COLUMN, 0 );
+		if ( SQL_SUCCEEDED(rc) )
+		{
+			rc = SQLSetStmtAttr( hstmt, SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER)(SQLULEN)blockSize, 0 );
+		}
+		if ( !SQL_SUCCEEDED(rc) )
+		{
+			Util::log( ERROR, "[NeuroTrDb::readSamples()] Driver refused a row array; fetching row by row." );
+			handle_errors( SQL_HANDLE_STMT, hstmt );
+			blockSize = 1;
+		}
 	}
 
 	sql = string("SELECT `return` FROM `neurotrdb`.`ftse100_futures_bars_t`") +
 				 "WHERE `bar_id` > 1  ORDER BY `bar_id`;";
-	rtn = SQLExecDirect( hstmt,
+	rc = SQLExecDirect( hstmt,
 						 (SQLCHAR *)sql.c_str(),
 						 SQL_NTS );
-	if ( !SQL_SUCCEEDED(rtn) )
+	if ( !SQL_SUCCEEDED(rc) )
 	{
-		Util::log( ERROR, "[NeuroTrDb::getReturns()] Could not SELECT returns from the database." );
+		Util::log( ERROR, "[NeuroTrDb::readSamples()] Could not SELECT returns from the database." );
+		handle_errors( SQL_HANDLE_STMT, hstmt );
 		rtn = -1;
+		goto readSamples_get_out;
 	}
-	Util::log( DEBUG, "[NeuroTrDb::getReturns()] Returns SELECTed." );
-
-	rc = SQLBindCol( hstmt, 1, SQL_C_FLOAT, (SQLPOINTER)&r.price, 1, &r.ind );
-
-	i=0;
-	while ( SQL_SUCCEEDED((rc = SQLFetch( hstmt ) ) ) )
+	Util::log( DEBUG, "[NeuroTrDb::readSamples()] Returns SELECTed." );
+
+	// The returns go into the store once; each sample is a window over them
+	// with the future bar to predict as its last element.
+	store.clear();
+	t0 = Util::getTime();
+	rows = ( blockSize > 1 ) ? fetchBlocks( hstmt, store, blockSize ) : fetchRows( hstmt, store );
+	secs = Util::getTime() - t0;
+	if ( rows < 0 )
 	{
-		if ( i < Param::InputSampleSize +1 )  // The last (+1) is the future bar to predict
-		{
-			sample.push_back( r.price );
-		}
-		else // a full sample read in
-		{
-			wnn.addSample( sample );
-
-			sample.pop_front();
-			sample.push_back( r.price );
-		}
-		++i;
+		rtn = -1;
+		goto readSamples_get_out;
 	}
-	wnn.addSample( sample ); // the last one
-	Util::log( DEBUG,  string("[NeuroTrDb::getReturns()] Read in ")
-			+ Util::itoa(wnn.getNumSamples()) + " training samples.");
 
-	if ( !wasConnected ) disconnect();
-	return 0;
+	Util::log( DEBUG,  string("[NeuroTrDb::readSamples()] Fetched ") + Util::itoa( rows ) + " returns in "
+			+ Util::ftoa( secs ) + "s ("
+			+ Util::ftoa( ( secs > 0 ) ? rows / secs : 0 ) + " rows/s, block size "
+			+ Util::itoa( blockSize ) + ")." );
+	Util::log( DEBUG,  string("[NeuroTrDb::readSamples()] Read in ")
+			+ Util::itoa(store.getNumWindows()) + " training samples.");
 
 
-execSQL_get_out:
+readSamples_get_out:
 
+	if ( hstmt != SQL_NULL_HANDLE )
+	{
+		SQLFreeHandle( SQL_HANDLE_STMT, hstmt );
+	}
 	if ( !wasConnected )
 	{
 		disconnect();
-		Util::log( DEBUG, "[AlgoDb::execSQL()] Disconnected from database." );
+		Util::log( DEBUG, "[NeuroTrDb::readSamples()] Disconnected from database." );
 	}
 
-	return -1;
+	return rtn;
 
 }
 
 
+long NeuroTrDb::fetchRows( SQLHSTMT hstmt, SampleStore &store )
+{
+	DbReturn r;
+	int rc;
+
+	rc = SQLBindCol( hstmt, 1, SQL_C_FLOAT, (SQLPOINTER)&r.price, sizeof(r.price), &r.ind );
+	if ( !SQL_SUCCEEDED(rc) )
+	{
+		Util::log( ERROR, "[NeuroTrDb::fetchRows()] Could not bind the return column." );
+		handle_errors( SQL_HANDLE_STMT, hstmt );
+		return -1;
+	}
+
+	while ( SQL_SUCCEEDED((rc = SQLFetch( hstmt ) ) ) )
+	{
+		store.addReturn( ( r.ind == SQL_NULL_DATA ) ? 0 : r.price );
+	}
+	if ( rc != SQL_NO_DATA )
+	{
+		Util::log( ERROR, "[NeuroTrDb::fetchRows()] SQLFetch failed." );
+		handle_errors( SQL_HANDLE_STMT, hstmt );
+		return -1;
+	}
+
+	return store.getNumReturns();
+}
 
 
+long NeuroTrDb::fetchBlocks( SQLHSTMT hstmt, SampleStore &store, unsigned int blockSize )
+{
+	vector<SQLLEN> ind( blockSize );
+	vector<SQLUSMALLINT> status( blockSize );
+	SQLULEN fetched = 0;
+	float *block;
+	int rc;
+
+	rc = SQLSetStmtAttr( hstmt, SQL_ATTR_ROW_STATUS_PTR, (SQLPOINTER)&status[0], 0 );
+	if ( SQL_SUCCEEDED(rc) )
+	{
+		rc = SQLSetStmtAttr( hstmt, SQL_ATTR_ROWS_FETCHED_PTR, (SQLPOINTER)&fetched, 0 );
+	}
+	if ( !SQL_SUCCEEDED(rc) )
+	{
+		Util::log( ERROR, "[NeuroTrDb::fetchBlocks()] Could not set the row status array." );
+		handle_errors( SQL_HANDLE_STMT, hstmt );
+		return -1;
+	}
 
+	for ( ;; )
+	{
+		// Fetch straight into the tail of the store. It may have moved since
+		// the last block, so the column is re-bound every time.
+		block = store.extend( blockSize );
+		rc = SQLBindCol( hstmt, 1, SQL_C_FLOAT, (SQLPOINTER)block, sizeof(float), &ind[0] );
+		if ( !SQL_SUCCEEDED(rc) )
+		{
+			Util::log( ERROR, "[NeuroTrDb::fetchBlocks()] Could not bind the return column." );
+			handle_errors( SQL_HANDLE_STMT, hstmt );
+			store.truncate( store.getNumReturns() - blockSize );
+			return -1;
+		}
 
+		fetched = 0;
+		rc = SQLFetch( hstmt );
+		if ( rc == SQL_NO_DATA )
+		{
+			fetched = 0;
+		}
+		else if ( !SQL_SUCCEEDED(rc) )
+		{
+			Util::log( ERROR, "[NeuroTrDb::fetchBlocks()] SQLFetch failed." );
+			handle_errors( SQL_HANDLE_STMT, hstmt );
+			store.truncate( store.getNumReturns() - blockSize );
+			return -1;
+		}
+
+		for ( SQLULEN i = 0; i < fetched; ++i )
+		{
+			if ( status[i] == SQL_ROW_ERROR )
+			{
+				Util::log( ERROR, string("[NeuroTrDb::fetchBlocks()] Error in fetched row ")
+								  + Util::itoa( store.getNumReturns() - blockSize + i ) + "." );
+				handle_errors( SQL_HANDLE_STMT, hstmt );
+				store.truncate( store.getNumReturns() - blockSize );
+				return -1;
+			}
+			if ( ind[i] == SQL_NULL_DATA )
+			{
+				block[i] = 0;
+			}
+		}
 
+		store.truncate( store.getNumReturns() - ( blockSize - fetched ) );
+		if ( fetched < blockSize )
+		{
+			break;
+		}
+	}
 
+	SQLFreeStmt( hstmt, SQL_UNBIND );
+	return store.getNumReturns();
+}
@@ -13,7 +13,9 @@
 #include <sqlext.h>
 #include <exception>
 
-#include "WaveletNN.h"
+#include "def.h"
+
+#include "SampleStore.h"
 
 
 using namespace std;
@@ -60,7 +62,9 @@ class NeuroTrDb: public Database
 	int clearTable( Table t );
 	int loadData();
 
-	int readSamples( WaveletNN &wnn );
+	// Reads the returns into the store. A block size above 1 fetches that
+	// many rows per driver round trip with a column-wise bound row array.
+	int readSamples( SampleStore &store, unsigned int blockSize = Param::DBFetchBlockSize );
 
 	struct DbReturn
 	{
@@ -72,6 +76,10 @@ class NeuroTrDb: public Database
 
 	static string _table[];
 
+	// Both return the number of returns in the store, or -1 on error.
+	long fetchRows( SQLHSTMT hstmt, SampleStore &store );
+	long fetchBlocks( SQLHSTMT hstmt, SampleStore &store, unsigned int blockSize );
+
 };
 
 